@@ -18,11 +18,19 @@
 
 #include <algorithm>
 #include <limits>
+#include <new>
+#include <string.h>
 // Code known to compile and run with Qt 4.3 through Qt 4.7.
 #include <QtCore>
 #include <time.h>
 #include "diff_match_patch.h"
 
+#if defined(__GNUC__) && defined(__SSE2__)
+// Substring search can test eight candidate positions at once.
+#define DIFF_MATCH_PATCH_SSE2
+#include <emmintrin.h>
+#endif
+
 
 //////////////////////////
 //
@@ -108,233 +116,1221 @@ bool Patch::isNull() const {
 
 
 /**
- * Emulate GNU diff's format.
- * Header: @@ -382,8 +481,9 @@
- * Indices are printed as 1-based, not 0-based.
- * @return The GNU diff string
+ * Number of characters QString::number() produces for an integer.
+ * @param n The integer.
+ * @return Length of its decimal representation.
  */
-QString Patch::toString() {
-  QString coords1, coords2;
-  if (length1 == 0) {
-    coords1 = QString::number(start1) + QString(",0");
-  } else if (length1 == 1) {
-    coords1 = QString::number(start1 + 1);
-  } else {
-    coords1 = QString::number(start1 + 1) + QString(",")
-        + QString::number(length1);
-  }
-  if (length2 == 0) {
-    coords2 = QString::number(start2) + QString(",0");
-  } else if (length2 == 1) {
-    coords2 = QString::number(start2 + 1);
-  } else {
-    coords2 = QString::number(start2 + 1) + QString(",")
-        + QString::number(length2);
+static int decimalLength(int n) {
+  int length = n < 0 ? 2 : 1;
+  // Work in the negative range so that INT_MIN does not overflow.
+  if (n > 0) {
+    n = -n;
   }
-  QString text;
-  text = QString("@@ -") + coords1 + QString(" +") + coords2
-      + QString(" @@\n");
-  // Escape the body of the patch with %xx notation.
-  foreach (Diff aDiff, diffs) {
-    switch (aDiff.operation) {
-      case INSERT:
-        text += QString('+');
-        break;
-      case DELETE:
-        text += QString('-');
-        break;
-      case EQUAL:
-        text += QString(' ');
-        break;
-    }
-    text += QString(QUrl::toPercentEncoding(aDiff.text, " !~*'();/?:@&=+$,#"))
-        + QString("\n");
+  while (n <= -10) {
+    n /= 10;
+    length++;
   }
+  return length;
+}
 
-  return text;
+
+/**
+ * Append an integer in decimal, as QString::number() would write it,
+ * without building a temporary string.
+ * @param text The string to append to.
+ * @param n The integer.
+ */
+static void appendDecimal(QString &text, int n) {
+  QChar digits[12];
+  int pointer = 12;
+  const bool negative = n < 0;
+  // Work in the negative range so that INT_MIN does not overflow.
+  if (n > 0) {
+    n = -n;
+  }
+  do {
+    digits[--pointer] = QChar(ushort('0' - n % 10));
+    n /= 10;
+  } while (n != 0);
+  if (negative) {
+    digits[--pointer] = QChar('-');
+  }
+  while (pointer < 12) {
+    text.append(digits[pointer++]);
+  }
 }
 
 
-/////////////////////////////////////////////
-//
-// diff_match_patch Class
-//
-/////////////////////////////////////////////
+// ASCII characters which percent-encoding leaves as they are: the URI
+// unreserved set plus " !~*'();/?:@&=+$,#", as passed to
+// QUrl::toPercentEncoding() by the other ports of this library.
+static const bool PERCENT_SAFE[128] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x00
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x10
+  1, 1, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x20
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1,  // 0x30
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x40
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,  // 0x50
+  0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x60
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,  // 0x70
+};
 
-diff_match_patch::diff_match_patch() :
-  Diff_Timeout(1.0f),
-  Diff_EditCost(4),
-  Match_Threshold(0.5f),
-  Match_Distance(1000),
-  Patch_DeleteThreshold(0.5f),
-  Patch_Margin(4),
-  Match_MaxBits(32) {
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+
+/**
+ * Length of a text once percent-encoded by appendPercentEncoded().
+ * @param text The text to be encoded.
+ * @return Number of encoded characters.
+ */
+static int percentEncodedLength(const QString &text) {
+  const QChar *chars = text.unicode();
+  const int size = text.length();
+  int length = 0;
+  for (int i = 0; i < size; i++) {
+    const ushort c = chars[i].unicode();
+    if (c < 0x80) {
+      length += PERCENT_SAFE[c] ? 1 : 3;
+    } else if (c < 0x800) {
+      length += 6;
+    } else if (c < 0xd800 || c >= 0xe000) {
+      length += 9;
+    } else if (c < 0xdc00 && i + 1 < size && chars[i + 1].isLowSurrogate()) {
+      length += 12;
+      i++;
+    } else {
+      length++;  // An unpaired surrogate becomes '?'.
+    }
+  }
+  return length;
 }
 
 
-QList<Diff> diff_match_patch::diff_main(const QString &text1,
-                                        const QString &text2) {
-  return diff_main(text1, text2, true);
+/**
+ * Append one UTF-8 byte to a string as %xx.
+ * @param out The string to append to.
+ * @param byte The byte.
+ */
+static inline void appendPercentByte(QString &out, uint byte) {
+  out.append(QChar('%'));
+  out.append(QChar(HEX_DIGITS[byte >> 4]));
+  out.append(QChar(HEX_DIGITS[byte & 0xf]));
 }
 
-QList<Diff> diff_match_patch::diff_main(const QString &text1,
-    const QString &text2, bool checklines) {
-  // Set a deadline by which time the diff must be complete.
-  clock_t deadline;
-  if (Diff_Timeout <= 0) {
-    deadline = std::numeric_limits<clock_t>::max();
-  } else {
-    deadline = clock() + (clock_t)(Diff_Timeout * CLOCKS_PER_SEC);
+
+/**
+ * Append a text to a string, percent-encoded for a delta or patch body.
+ * Works on the UTF-16 text directly and produces the same characters as
+ * QUrl::toPercentEncoding(text, " !~*'();/?:@&=+$,#"), unpaired surrogates
+ * being encoded as '?' the way QString::toUtf8() converts them.
+ * @param out The string to append to.
+ * @param chars Characters to be encoded.
+ * @param size Number of characters.
+ */
+static void appendPercentEncoded(QString &out, const QChar *chars, int size) {
+  for (int i = 0; i < size; i++) {
+    uint c = chars[i].unicode();
+    if (c < 0x80) {
+      if (PERCENT_SAFE[c]) {
+        out.append(chars[i]);
+      } else {
+        appendPercentByte(out, c);
+      }
+    } else if (c < 0x800) {
+      appendPercentByte(out, 0xc0 | (c >> 6));
+      appendPercentByte(out, 0x80 | (c & 0x3f));
+    } else if (c < 0xd800 || c >= 0xe000) {
+      appendPercentByte(out, 0xe0 | (c >> 12));
+      appendPercentByte(out, 0x80 | ((c >> 6) & 0x3f));
+      appendPercentByte(out, 0x80 | (c & 0x3f));
+    } else if (c < 0xdc00 && i + 1 < size && chars[i + 1].isLowSurrogate()) {
+      c = 0x10000 + ((c - 0xd800) << 10) + (chars[i + 1].unicode() - 0xdc00);
+      i++;
+      appendPercentByte(out, 0xf0 | (c >> 18));
+      appendPercentByte(out, 0x80 | ((c >> 12) & 0x3f));
+      appendPercentByte(out, 0x80 | ((c >> 6) & 0x3f));
+      appendPercentByte(out, 0x80 | (c & 0x3f));
+    } else {
+      out.append(QChar('?'));
+    }
   }
-  return diff_main(text1, text2, checklines, deadline);
 }
 
-QList<Diff> diff_match_patch::diff_main(const QString &text1,
-    const QString &text2, bool checklines, clock_t deadline) {
-  // Check for null inputs.
-  if (text1.isNull() || text2.isNull()) {
-    throw "Null inputs. (diff_main)";
+
+/**
+ * Value of a hexadecimal digit.
+ * @param c The character.
+ * @return 0 to 15, or -1 if the character is not a hex digit.
+ */
+static inline int hexValue(ushort c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
   }
+  return -1;
+}
 
-  // Check for equality (speedup).
-  QList<Diff> diffs;
-  if (text1 == text2) {
-    if (!text1.isEmpty()) {
-      diffs.append(Diff(EQUAL, text1));
+
+/**
+ * Decode a percent-encoded delta or patch body.
+ * Equivalent to QUrl::fromPercentEncoding() on the UTF-8 form of the text,
+ * but runs of plain ASCII are copied straight across; only escaped bytes
+ * and literal non-ASCII characters go through UTF-8 decoding.  '+' is left
+ * alone and a '%' not followed by two hex digits is kept literally.
+ * @param chars Encoded characters.
+ * @param length Number of characters.
+ * @return The decoded text.
+ */
+static QString percentDecoded(const QChar *chars, int length) {
+  QString text;
+  text.reserve(length);
+  QByteArray bytes;  // Pending run of non-ASCII UTF-8 bytes.
+  for (int i = 0; i < length; i++) {
+    const ushort c = chars[i].unicode();
+    int byte = -1;
+    if (c == '%' && i + 2 < length) {
+      const int high = hexValue(chars[i + 1].unicode());
+      const int low = hexValue(chars[i + 2].unicode());
+      if (high >= 0 && low >= 0) {
+        byte = (high << 4) | low;
+        i += 2;
+      }
     }
-    return diffs;
+    if (byte >= 0x80) {
+      bytes.append(static_cast<char>(byte));
+      continue;
+    }
+    if (c >= 0x80) {
+      // A literal non-ASCII character; decode it with its neighbours.
+      int end = i + 1;
+      while (end < length && chars[end].unicode() >= 0x80) {
+        end++;
+      }
+      bytes.append(QString(chars + i, end - i).toUtf8());
+      i = end - 1;
+      continue;
+    }
+    if (!bytes.isEmpty()) {
+      text.append(QString::fromUtf8(bytes.constData(), bytes.size()));
+      bytes.clear();
+    }
+    text.append(QChar(byte >= 0 ? ushort(byte) : c));
+  }
+  if (!bytes.isEmpty()) {
+    text.append(QString::fromUtf8(bytes.constData(), bytes.size()));
   }
+  return text;
+}
 
-  // Trim off common prefix (speedup).
-  int commonlength = diff_commonPrefix(text1, text2);
-  const QString &commonprefix = text1.left(commonlength);
-  QString textChopped1 = text1.mid(commonlength);
-  QString textChopped2 = text2.mid(commonlength);
 
-  // Trim off common suffix (speedup).
-  commonlength = diff_commonSuffix(textChopped1, textChopped2);
-  const QString &commonsuffix = textChopped1.right(commonlength);
-  textChopped1 = textChopped1.left(textChopped1.length() - commonlength);
-  textChopped2 = textChopped2.left(textChopped2.length() - commonlength);
+/**
+ * Length of the "@@ -start1,length1" style coordinates of one side of a
+ * patch header.
+ * @param start Start offset (0-based).
+ * @param length Length of the range.
+ * @return Number of characters.
+ */
+static int coordsLength(int start, int length) {
+  if (length == 0) {
+    return decimalLength(start) + 2;
+  } else if (length == 1) {
+    return decimalLength(start + 1);
+  }
+  return decimalLength(start + 1) + 1 + decimalLength(length);
+}
 
-  // Compute the diff on the middle block.
-  diffs = diff_compute(textChopped1, textChopped2, checklines, deadline);
 
-  // Restore the prefix and suffix.
-  if (!commonprefix.isEmpty()) {
-    diffs.prepend(Diff(EQUAL, commonprefix));
-  }
-  if (!commonsuffix.isEmpty()) {
-    diffs.append(Diff(EQUAL, commonsuffix));
+/**
+ * Append one side of a patch header, 1-based as GNU diff prints it.
+ * @param text The string to append to.
+ * @param start Start offset (0-based).
+ * @param length Length of the range.
+ */
+static void appendCoords(QString &text, int start, int length) {
+  if (length == 0) {
+    appendDecimal(text, start);
+    text.append(",0");
+  } else if (length == 1) {
+    appendDecimal(text, start + 1);
+  } else {
+    appendDecimal(text, start + 1);
+    text.append(',');
+    appendDecimal(text, length);
   }
+}
 
-  diff_cleanupMerge(diffs);
 
-  return diffs;
+/**
+ * Exact length of a patch in GNU diff format.
+ * @param patch The patch.
+ * @return Number of characters Patch::toString() produces.
+ */
+static int patchTextLength(const Patch &patch) {
+  // "@@ -" + coords1 + " +" + coords2 + " @@\n"
+  int length = 4 + coordsLength(patch.start1, patch.length1)
+      + 2 + coordsLength(patch.start2, patch.length2) + 4;
+  foreach(const Diff &aDiff, patch.diffs) {
+    length += 1 + percentEncodedLength(aDiff.text) + 1;
+  }
+  return length;
 }
 
 
-QList<Diff> diff_match_patch::diff_compute(QString text1, QString text2,
-    bool checklines, clock_t deadline) {
-  QList<Diff> diffs;
+/**
+ * Append the header line of a patch in GNU diff format to a string.
+ * @param text The string to append to.
+ * @param patch The patch.
+ */
+static void appendPatchHeader(QString &text, const Patch &patch) {
+  text.append("@@ -");
+  appendCoords(text, patch.start1, patch.length1);
+  text.append(" +");
+  appendCoords(text, patch.start2, patch.length2);
+  text.append(" @@\n");
+}
 
-  if (text1.isEmpty()) {
-    // Just add some text (speedup).
-    diffs.append(Diff(INSERT, text2));
-    return diffs;
+
+/**
+ * Sign which starts a line of a patch body.
+ * @param op Operation of the diff on that line.
+ * @return '+', '-' or ' '.
+ */
+static inline QChar patchLineSign(Operation op) {
+  switch (op) {
+    case INSERT:
+      return QChar('+');
+    case DELETE:
+      return QChar('-');
+    case EQUAL:
+      break;
   }
+  return QChar(' ');
+}
 
-  if (text2.isEmpty()) {
-    // Just delete some text (speedup).
-    diffs.append(Diff(DELETE, text1));
-    return diffs;
+
+/**
+ * Append a patch in GNU diff format to a string.
+ * @param text The string to append to.
+ * @param patch The patch.
+ */
+static void appendPatchText(QString &text, const Patch &patch) {
+  appendPatchHeader(text, patch);
+  // Escape the body of the patch with %xx notation.
+  foreach(const Diff &aDiff, patch.diffs) {
+    text.append(patchLineSign(aDiff.operation));
+    appendPercentEncoded(text, aDiff.text.unicode(), aDiff.text.length());
+    text.append('\n');
   }
+}
 
-  {
-    const QString longtext = text1.length() > text2.length() ? text1 : text2;
-    const QString shorttext = text1.length() > text2.length() ? text2 : text1;
-    const int i = longtext.indexOf(shorttext);
-    if (i != -1) {
-      // Shorter text is inside the longer text (speedup).
-      const Operation op = (text1.length() > text2.length()) ? DELETE : INSERT;
-      diffs.append(Diff(op, longtext.left(i)));
-      diffs.append(Diff(EQUAL, shorttext));
-      diffs.append(Diff(op, safeMid(longtext, i + shorttext.length())));
-      return diffs;
-    }
 
-    if (shorttext.length() == 1) {
-      // Single character string.
-      // After the previous speedup, the character can't be an equality.
-      diffs.append(Diff(DELETE, text1));
-      diffs.append(Diff(INSERT, text2));
-      return diffs;
+/**
+ * Emulate GNU diff's format.
+ * Header: @@ -382,8 +481,9 @@
+ * Indices are printed as 1-based, not 0-based.
+ * @return The GNU diff string
+ */
+QString Patch::toString() const {
+  QString text;
+  text.reserve(patchTextLength(*this));
+  appendPatchText(text, *this);
+  return text;
+}
+
+
+/////////////////////////////////////////////
+//
+// LocationIndex Class
+//
+/////////////////////////////////////////////
+
+
+LocationIndex::LocationIndex(const QList<Diff> &diffs) {
+  starts1.reserve(diffs.size() + 1);
+  starts2.reserve(diffs.size() + 1);
+  deletions.reserve(diffs.size());
+  int chars1 = 0;
+  int chars2 = 0;
+  foreach(const Diff &aDiff, diffs) {
+    starts1.append(chars1);
+    starts2.append(chars2);
+    deletions.append(aDiff.operation == DELETE);
+    if (aDiff.operation != INSERT) {
+      // Equality or deletion.
+      chars1 += aDiff.text.length();
+    }
+    if (aDiff.operation != DELETE) {
+      // Equality or insertion.
+      chars2 += aDiff.text.length();
     }
-    // Garbage collect longtext and shorttext by scoping out.
   }
+  starts1.append(chars1);
+  starts2.append(chars2);
+}
 
-  // Check to see if the problem can be split in two.
-  const QStringList hm = diff_halfMatch(text1, text2);
-  if (hm.count() > 0) {
-    // A half-match was found, sort out the return data.
-    const QString text1_a = hm[0];
-    const QString text1_b = hm[1];
-    const QString text2_a = hm[2];
-    const QString text2_b = hm[3];
-    const QString mid_common = hm[4];
-    // Send both pairs off for separate processing.
-    const QList<Diff> diffs_a = diff_main(text1_a, text2_a,
-                                          checklines, deadline);
-    const QList<Diff> diffs_b = diff_main(text1_b, text2_b,
-                                          checklines, deadline);
-    // Merge the results.
-    diffs = diffs_a;
-    diffs.append(Diff(EQUAL, mid_common));
-    diffs += diffs_b;
-    return diffs;
-  }
 
-  // Perform a real diff.
-  if (checklines && text1.length() > 100 && text2.length() > 100) {
-    return diff_lineMode(text1, text2, deadline);
+int LocationIndex::xIndex(int loc) const {
+  return translate(segment(loc), loc);
+}
+
+
+QVector<int> LocationIndex::xIndex(const QVector<int> &locs) const {
+  QVector<int> results(locs.size());
+  const int diffs = deletions.size();
+  int current = 0;
+  for (int i = 0; i < locs.size(); i++) {
+    const int loc = locs[i];
+    if (loc < starts1[current]) {
+      // Out of order; start again.
+      current = segment(loc);
+    } else {
+      while (current < diffs && starts1[current + 1] <= loc) {
+        current++;
+      }
+    }
+    results[i] = translate(current, loc);
   }
+  return results;
+}
+
 
-  return diff_bisect(text1, text2, deadline);
+int LocationIndex::segment(int loc) const {
+  // The first diff whose text1 end lies beyond loc.
+  const int *ends1 = starts1.constData() + 1;
+  return std::upper_bound(ends1, ends1 + deletions.size(), loc) - ends1;
 }
 
 
-QList<Diff> diff_match_patch::diff_lineMode(QString text1, QString text2,
-    clock_t deadline) {
-  // Scan the text on a line-by-line basis first.
-  const QList<QVariant> b = diff_linesToChars(text1, text2);
-  text1 = b[0].toString();
-  text2 = b[1].toString();
-  QStringList linearray = b[2].toStringList();
+int LocationIndex::translate(int segment, int loc) const {
+  if (segment < deletions.size() && deletions[segment]) {
+    // The location was deleted.
+    return starts2[segment];
+  }
+  // Add the remaining character length.
+  return starts2[segment] + (loc - starts1[segment]);
+}
 
-  QList<Diff> diffs = diff_main(text1, text2, false, deadline);
 
-  // Convert the diff back to original text.
-  diff_charsToLines(diffs, linearray);
-  // Eliminate freak matches (e.g. blank lines)
-  diff_cleanupSemantic(diffs);
+/////////////////////////////////////////////
+//
+// TextBuffer Class
+//
+/////////////////////////////////////////////
 
-  // Rediff any replacement blocks, this time character-by-character.
-  // Add a dummy entry at the end.
-  diffs.append(Diff(EQUAL, ""));
-  int count_delete = 0;
-  int count_insert = 0;
-  QString text_delete = "";
-  QString text_insert = "";
 
-  QMutableListIterator<Diff> pointer(diffs);
-  Diff *thisDiff = pointer.hasNext() ? &pointer.next() : NULL;
-  while (thisDiff != NULL) {
-    switch (thisDiff->operation) {
-      case INSERT:
-        count_insert++;
-        text_insert += thisDiff->text;
-        break;
-      case DELETE:
+TextBuffer::TextBuffer(const QString &text) :
+  buffer(text), gapStart(text.length()), gapEnd(text.length()) {
+}
+
+
+QString TextBuffer::mid(int pos, int len) const {
+  // Mirror QString::mid().
+  const int size = length();
+  if (pos >= size) {
+    return QString();
+  }
+  if (len < 0) {
+    len = size - pos;
+  }
+  if (pos < 0) {
+    len += pos;
+    pos = 0;
+  }
+  len = std::min(len, size - pos);
+  QString result;
+  result.resize(len);
+  QChar *out = result.data();
+  const QChar *chars = buffer.unicode();
+  // Part before the gap, then part after it.
+  const int before = std::max(0, std::min(pos + len, gapStart) - pos);
+  memcpy(out, chars + pos, before * sizeof(QChar));
+  memcpy(out + before, chars + gapEnd + (pos + before - gapStart),
+         (len - before) * sizeof(QChar));
+  return result;
+}
+
+
+void TextBuffer::replace(int pos, int len, const QString &text) {
+  moveGap(pos);
+  gapEnd += len;
+  if (gapEnd - gapStart < text.length()) {
+    // Grow, leaving room for as much again.
+    const int tail = buffer.length() - gapEnd;
+    QString grown;
+    grown.resize(2 * (gapStart + tail + text.length()));
+    memcpy(grown.data(), buffer.unicode(), gapStart * sizeof(QChar));
+    memcpy(grown.data() + grown.length() - tail, buffer.unicode() + gapEnd,
+           tail * sizeof(QChar));
+    gapEnd = grown.length() - tail;
+    buffer = grown;
+  }
+  memcpy(buffer.data() + gapStart, text.unicode(),
+         text.length() * sizeof(QChar));
+  gapStart += text.length();
+}
+
+
+const QChar *TextBuffer::prefix(int end) {
+  if (end > gapStart) {
+    moveGap(end);
+  }
+  return buffer.unicode();
+}
+
+
+void TextBuffer::moveGap(int pos) {
+  QChar *chars = buffer.data();
+  if (pos < gapStart) {
+    const int count = gapStart - pos;
+    memmove(chars + gapEnd - count, chars + pos, count * sizeof(QChar));
+    gapStart -= count;
+    gapEnd -= count;
+  } else if (pos > gapStart) {
+    const int count = pos - gapStart;
+    memmove(chars + gapStart, chars + gapEnd, count * sizeof(QChar));
+    gapStart += count;
+    gapEnd += count;
+  }
+}
+
+
+/////////////////////////////////////////////
+//
+// MatchAlphabet Class
+//
+/////////////////////////////////////////////
+
+
+MatchAlphabet::MatchAlphabet(const QString &pattern) :
+  wordCount(std::max(1, (pattern.length() + 63) / 64)),
+  latin1(256 * wordCount, 0) {
+  const QChar *chars = pattern.unicode();
+  const int length = pattern.length();
+  for (int i = 0; i < length; i++) {
+    const ushort c = chars[i].unicode();
+    const int bit = length - i - 1;
+    const quint64 value = Q_UINT64_C(1) << (bit % 64);
+    if (c < 256) {
+      latin1[c * wordCount + bit / 64] |= value;
+      continue;
+    }
+    const ushort *begin = others.constData();
+    const int index = std::lower_bound(begin, begin + others.size(), c) - begin;
+    if (index == others.size() || others[index] != c) {
+      others.insert(index, c);
+      otherMasks.insert(index * wordCount, wordCount, 0);
+    }
+    otherMasks[index * wordCount + bit / 64] |= value;
+  }
+  // The mask of every character not in the pattern.
+  otherMasks.insert(otherMasks.size(), wordCount, 0);
+}
+
+
+const quint64 *MatchAlphabet::otherMask(ushort c) const {
+  const ushort *begin = others.constData();
+  const ushort *end = begin + others.size();
+  const ushort *found = std::lower_bound(begin, end, c);
+  if (found == end || *found != c) {
+    found = end;
+  }
+  return otherMasks.constData() + (found - begin) * wordCount;
+}
+
+
+/////////////////////////////////////////////
+//
+// TextSearch Class
+//
+/////////////////////////////////////////////
+
+
+/**
+ * Does the pattern occur at a position whose first and last characters are
+ * already known to match?
+ * @param text Start of the candidate in the text.
+ * @param pattern The pattern.
+ * @param length Length of the pattern, at least 1.
+ * @return True if every character matches.
+ */
+static inline bool matchesInside(const QChar *text, const QChar *pattern,
+                                 int length) {
+  return length <= 2 || memcmp(text + 1, pattern + 1,
+                               (length - 2) * sizeof(QChar)) == 0;
+}
+
+
+#ifdef DIFF_MATCH_PATCH_SSE2
+/**
+ * Flag the positions among eight consecutive candidates whose first and last
+ * characters match the pattern's.
+ * @param text First candidate position.
+ * @param length Length of the pattern.
+ * @param first The pattern's first character in every lane.
+ * @param last The pattern's last character in every lane.
+ * @return Two bits per candidate, lowest candidate in the lowest bits.
+ */
+static inline unsigned int candidateMask(const QChar *text, int length,
+                                         __m128i first, __m128i last) {
+  const __m128i head = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(text));
+  const __m128i tail = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(text + length - 1));
+  return _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(head, first),
+                                         _mm_cmpeq_epi16(tail, last)));
+}
+#endif
+
+
+int TextSearch::indexOf(const QString &text, const QString &pattern,
+                        int from) {
+  if (from < 0) {
+    from = std::max(from + text.length(), 0);
+  }
+  if (from > text.length()) {
+    return -1;
+  }
+  return indexOf(text.unicode(), text.length(), pattern.unicode(),
+                 pattern.length(), from);
+}
+
+
+int TextSearch::lastIndexOf(const QString &text, const QString &pattern,
+                            int from) {
+  if (from < 0) {
+    from += text.length();
+  }
+  if (from == text.length() && pattern.isEmpty()) {
+    return from;
+  }
+  const int delta = text.length() - pattern.length();
+  if (from < 0 || from >= text.length() || delta < 0) {
+    return -1;
+  }
+  return lastIndexOf(text.unicode(), text.length(), pattern.unicode(),
+                     pattern.length(), std::min(from, delta));
+}
+
+
+int TextSearch::indexOf(const QChar *text, int textLength,
+                        const QChar *pattern, int patternLength, int from) {
+  if (patternLength == 0) {
+    return from;
+  }
+  // Last position at which the pattern could start.
+  const int end = textLength - patternLength;
+  int i = from;
+#ifdef DIFF_MATCH_PATCH_SSE2
+  const __m128i first = _mm_set1_epi16(static_cast<short>(pattern[0].unicode()));
+  const __m128i last = _mm_set1_epi16(
+      static_cast<short>(pattern[patternLength - 1].unicode()));
+  for (; i + 8 <= end + 1; i += 8) {
+    unsigned int mask = candidateMask(text + i, patternLength, first, last);
+    while (mask != 0) {
+      const int bit = __builtin_ctz(mask);
+      if (matchesInside(text + i + bit / 2, pattern, patternLength)) {
+        return i + bit / 2;
+      }
+      mask &= ~(3u << bit);
+    }
+  }
+  for (; i <= end; i++) {
+    if (text[i] == pattern[0] && text[i + patternLength - 1]
+        == pattern[patternLength - 1]
+        && matchesInside(text + i, pattern, patternLength)) {
+      return i;
+    }
+  }
+#else
+  // Horspool: shift by the distance from the window's last character to its
+  // last occurrence earlier in the pattern (tabled on its low byte).
+  int shift[256];
+  std::fill(shift, shift + 256, patternLength);
+  for (int k = 0; k < patternLength - 1; k++) {
+    shift[pattern[k].unicode() & 0xFF] = patternLength - 1 - k;
+  }
+  const QChar lastChar = pattern[patternLength - 1];
+  while (i <= end) {
+    const QChar c = text[i + patternLength - 1];
+    if (c == lastChar && memcmp(text + i, pattern,
+                                (patternLength - 1) * sizeof(QChar)) == 0) {
+      return i;
+    }
+    i += shift[c.unicode() & 0xFF];
+  }
+#endif
+  return -1;
+}
+
+
+int TextSearch::lastIndexOf(const QChar *text, int textLength,
+                            const QChar *pattern, int patternLength,
+                            int from) {
+  Q_UNUSED(textLength);
+  if (patternLength == 0) {
+    return from;
+  }
+  int i = from;
+#ifdef DIFF_MATCH_PATCH_SSE2
+  const __m128i first = _mm_set1_epi16(static_cast<short>(pattern[0].unicode()));
+  const __m128i last = _mm_set1_epi16(
+      static_cast<short>(pattern[patternLength - 1].unicode()));
+  // Blocks of eight candidates ending at i, highest first.
+  for (; i - 7 >= 0; i -= 8) {
+    unsigned int mask = candidateMask(text + i - 7, patternLength, first,
+                                      last);
+    while (mask != 0) {
+      const int bit = 31 - __builtin_clz(mask);
+      if (matchesInside(text + i - 7 + bit / 2, pattern, patternLength)) {
+        return i - 7 + bit / 2;
+      }
+      mask &= ~(3u << (bit - 1));
+    }
+  }
+  for (; i >= 0; i--) {
+    if (text[i] == pattern[0] && text[i + patternLength - 1]
+        == pattern[patternLength - 1]
+        && matchesInside(text + i, pattern, patternLength)) {
+      return i;
+    }
+  }
+#else
+  // Horspool backwards: shift by the distance from the window's first
+  // character to its first occurrence later in the pattern.
+  int shift[256];
+  std::fill(shift, shift + 256, patternLength);
+  for (int k = patternLength - 1; k > 0; k--) {
+    shift[pattern[k].unicode() & 0xFF] = k;
+  }
+  const QChar firstChar = pattern[0];
+  while (i >= 0) {
+    const QChar c = text[i];
+    if (c == firstChar && memcmp(text + i + 1, pattern + 1,
+                                 (patternLength - 1) * sizeof(QChar)) == 0) {
+      return i;
+    }
+    i -= shift[c.unicode() & 0xFF];
+  }
+#endif
+  return -1;
+}
+
+
+/////////////////////////////////////////////
+//
+// PreparedText Class
+//
+/////////////////////////////////////////////
+
+
+PreparedText::PreparedText(const QString &text, int _qgramLength) :
+  source(text), qgramLength(std::max(1, std::min(_qgramLength, 4))) {
+  const QChar *chars = source.unicode();
+  for (int i = 0; i + qgramLength <= source.length(); i++) {
+    grams[gramKey(chars + i)].append(i);
+  }
+}
+
+
+quint64 PreparedText::gramKey(const QChar *chars) const {
+  quint64 key = 0;
+  for (int k = 0; k < qgramLength; k++) {
+    key = (key << 16) | chars[k].unicode();
+  }
+  return key;
+}
+
+
+const QVector<int> *PreparedText::rarestGram(const QString &pattern,
+                                             int *offset) const {
+  const QVector<int> *rarest = NULL;
+  const QChar *chars = pattern.unicode();
+  for (int k = 0; k + qgramLength <= pattern.length(); k++) {
+    QHash<quint64, QVector<int> >::const_iterator found =
+        grams.constFind(gramKey(chars + k));
+    if (found == grams.constEnd()) {
+      return NULL;
+    }
+    if (rarest == NULL || found.value().size() < rarest->size()) {
+      rarest = &found.value();
+      *offset = k;
+    }
+  }
+  return rarest;
+}
+
+
+int PreparedText::indexOf(const QString &pattern, int from) const {
+  if (pattern.length() < qgramLength || from < 0) {
+    return TextSearch::indexOf(source, pattern, from);
+  }
+  int offset;
+  const QVector<int> *positions = rarestGram(pattern, &offset);
+  if (positions == NULL) {
+    return -1;
+  }
+  const QChar *chars = source.unicode();
+  const int *end = positions->constEnd();
+  for (const int *p = std::lower_bound(positions->constBegin(), end,
+                                       from + offset); p != end; ++p) {
+    const int start = *p - offset;
+    if (start + pattern.length() <= source.length()
+        && memcmp(chars + start, pattern.unicode(),
+                  pattern.length() * sizeof(QChar)) == 0) {
+      return start;
+    }
+  }
+  return -1;
+}
+
+
+int PreparedText::lastIndexOf(const QString &pattern, int from) const {
+  if (pattern.length() < qgramLength || from < 0) {
+    return TextSearch::lastIndexOf(source, pattern, from);
+  }
+  if (from >= source.length()) {
+    return -1;
+  }
+  int offset;
+  const QVector<int> *positions = rarestGram(pattern, &offset);
+  if (positions == NULL) {
+    return -1;
+  }
+  const QChar *chars = source.unicode();
+  const int *begin = positions->constBegin();
+  const int *p = std::upper_bound(begin, positions->constEnd(),
+                                  from + offset);
+  while (p != begin) {
+    const int start = *--p - offset;
+    if (start < 0) {
+      break;
+    }
+    if (start + pattern.length() <= source.length()
+        && memcmp(chars + start, pattern.unicode(),
+                  pattern.length() * sizeof(QChar)) == 0) {
+      return start;
+    }
+  }
+  return -1;
+}
+
+
+int PreparedText::sharedGrams(const QString &pattern, int first,
+                              int last) const {
+  int shared = 0;
+  const QChar *chars = pattern.unicode();
+  for (int k = 0; k + qgramLength <= pattern.length(); k++) {
+    QHash<quint64, QVector<int> >::const_iterator found =
+        grams.constFind(gramKey(chars + k));
+    if (found != grams.constEnd()) {
+      const int *end = found.value().constEnd();
+      const int *p = std::lower_bound(found.value().constBegin(), end, first);
+      if (p != end && *p <= last) {
+        shared++;
+      }
+    }
+  }
+  return shared;
+}
+
+
+/////////////////////////////////////////////
+//
+// CompiledPatchSet Class
+//
+/////////////////////////////////////////////
+
+
+CompiledPatchSet::CompiledPatchSet() : maxBits(0) {
+}
+
+
+/////////////////////////////////////////////
+//
+// PatchReader Class
+//
+/////////////////////////////////////////////
+
+
+/**
+ * Read a run of ASCII digits as QString::toInt() would convert it.
+ * @param chars The line.
+ * @param length Length of the line.
+ * @param pointer Where to start; moved past the digits.
+ * @param value Receives the number, or 0 if it does not fit in an int.
+ * @return Number of digits read.
+ */
+static int readDigits(const QChar *chars, int length, int &pointer,
+                      int &value) {
+  const int start = pointer;
+  qint64 number = 0;
+  while (pointer < length && chars[pointer].unicode() >= '0'
+      && chars[pointer].unicode() <= '9') {
+    if (number <= std::numeric_limits<int>::max()) {
+      number = number * 10 + (chars[pointer].unicode() - '0');
+    }
+    pointer++;
+  }
+  value = number <= std::numeric_limits<int>::max() ? int(number) : 0;
+  return pointer - start;
+}
+
+
+/**
+ * Read one side of a patch header: "start,length", "start" (a length of
+ * one) or "start,0" (an empty range, whose start is not 1-based).
+ * @param chars The line.
+ * @param length Length of the line.
+ * @param pointer Where to start; moved past the coordinates.
+ * @param start Receives the 0-based start.
+ * @param count Receives the length of the range.
+ * @return False if there is no start.
+ */
+static bool readCoords(const QChar *chars, int length, int &pointer,
+                       int &start, int &count) {
+  if (readDigits(chars, length, pointer, start) == 0) {
+    return false;
+  }
+  if (pointer < length && chars[pointer] == QChar(',')) {
+    pointer++;
+  }
+  const int digits = readDigits(chars, length, pointer, count);
+  if (digits == 0) {
+    start--;
+    count = 1;
+  } else if (digits == 1 && chars[pointer - 1] == QChar('0')) {
+    count = 0;
+  } else {
+    start--;
+  }
+  return true;
+}
+
+
+/**
+ * Whether a line continues with the given ASCII text.
+ * @param chars The line.
+ * @param length Length of the line.
+ * @param pointer Where to look; moved past the text if it is there.
+ * @param ascii The expected text.
+ * @return True if it is there.
+ */
+static bool readLiteral(const QChar *chars, int length, int &pointer,
+                        const char *ascii) {
+  const int size = int(strlen(ascii));
+  if (length - pointer < size) {
+    return false;
+  }
+  for (int i = 0; i < size; i++) {
+    if (chars[pointer + i].unicode() != ushort(ascii[i])) {
+      return false;
+    }
+  }
+  pointer += size;
+  return true;
+}
+
+
+PatchReader::PatchReader(QIODevice *_device) :
+  device(_device), pointer(0), lineStart(0), lineLength(0), pending(false) {
+}
+
+
+PatchReader::PatchReader(const QString &_text) :
+  device(NULL), text(_text), pointer(0), lineStart(0), lineLength(0),
+  pending(false) {
+}
+
+
+bool PatchReader::readLine() {
+  if (device != NULL) {
+    while (true) {
+      QByteArray bytes = device->readLine();
+      if (bytes.isEmpty()) {
+        return false;
+      }
+      if (bytes.endsWith('\n')) {
+        bytes.chop(1);
+      }
+      if (!bytes.isEmpty()) {
+        text = QString::fromUtf8(bytes.constData(), bytes.size());
+        lineStart = 0;
+        lineLength = text.length();
+        return true;
+      }
+    }
+  }
+  while (pointer < text.length()) {
+    int end = text.indexOf('\n', pointer);
+    if (end == -1) {
+      end = text.length();
+    }
+    lineStart = pointer;
+    lineLength = end - pointer;
+    pointer = end + 1;
+    if (lineLength != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool PatchReader::hasNext() {
+  if (!pending) {
+    pending = readLine();
+  }
+  return pending;
+}
+
+
+Patch PatchReader::next() {
+  if (!hasNext()) {
+    throw "No more patches. (PatchReader)";
+  }
+  // Header: @@ -382,8 +481,9 @@
+  const QChar *chars = text.unicode() + lineStart;
+  int cursor = 0;
+  Patch patch;
+  if (!readLiteral(chars, lineLength, cursor, "@@ -")
+      || !readCoords(chars, lineLength, cursor, patch.start1, patch.length1)
+      || !readLiteral(chars, lineLength, cursor, " +")
+      || !readCoords(chars, lineLength, cursor, patch.start2, patch.length2)
+      || !readLiteral(chars, lineLength, cursor, " @@")
+      || cursor != lineLength) {
+    throw QString("Invalid patch string: %1")
+        .arg(QString(chars, lineLength));
+  }
+
+  char sign;
+  QString line;
+  while ((pending = readLine())) {
+    chars = text.unicode() + lineStart;
+    sign = chars[0].toAscii();
+    if (sign == '@') {
+      // Start of next patch.
+      break;
+    }
+    line = percentDecoded(chars + 1, lineLength - 1);
+    if (sign == '-') {
+      // Deletion.
+      patch.diffs.append(Diff(DELETE, line));
+    } else if (sign == '+') {
+      // Insertion.
+      patch.diffs.append(Diff(INSERT, line));
+    } else if (sign == ' ') {
+      // Minor equality.
+      patch.diffs.append(Diff(EQUAL, line));
+    } else {
+      // WTF?
+      throw QString("Invalid patch mode '%1' in: %2").arg(sign).arg(line);
+    }
+  }
+  return patch;
+}
+
+
+/////////////////////////////////////////////
+//
+// diff_match_patch Class
+//
+/////////////////////////////////////////////
+
+diff_match_patch::diff_match_patch() :
+  Diff_Timeout(1.0f),
+  Diff_MaxMemory(0),
+  Diff_EditCost(4),
+  Match_Threshold(0.5f),
+  Match_Distance(1000),
+  Patch_DeleteThreshold(0.5f),
+  Patch_Margin(4),
+  Match_MaxBits(32) {
+}
+
+
+QList<Diff> diff_match_patch::diff_main(const QString &text1,
+                                        const QString &text2) const {
+  return diff_main(text1, text2, true);
+}
+
+QList<Diff> diff_match_patch::diff_main(const QString &text1,
+    const QString &text2, bool checklines) const {
+  // Set a deadline by which time the diff must be complete.
+  clock_t deadline;
+  if (Diff_Timeout <= 0) {
+    deadline = std::numeric_limits<clock_t>::max();
+  } else {
+    deadline = clock() + (clock_t)(Diff_Timeout * CLOCKS_PER_SEC);
+  }
+  return diff_main(text1, text2, checklines, deadline, 0);
+}
+
+QList<Diff> diff_match_patch::diff_main(const QString &text1,
+    const QString &text2, bool checklines, clock_t deadline,
+    qint64 memory) const {
+  // Check for null inputs.
+  if (text1.isNull() || text2.isNull()) {
+    throw "Null inputs. (diff_main)";
+  }
+
+  // Check for equality (speedup).
+  QList<Diff> diffs;
+  if (text1 == text2) {
+    if (!text1.isEmpty()) {
+      diffs.append(Diff(EQUAL, text1));
+    }
+    return diffs;
+  }
+
+  // Trim off common prefix (speedup).
+  int commonlength = diff_commonPrefix(text1, text2);
+  const QString &commonprefix = text1.left(commonlength);
+  QString textChopped1 = text1.mid(commonlength);
+  QString textChopped2 = text2.mid(commonlength);
+
+  // Trim off common suffix (speedup).
+  commonlength = diff_commonSuffix(textChopped1, textChopped2);
+  const QString &commonsuffix = textChopped1.right(commonlength);
+  textChopped1 = textChopped1.left(textChopped1.length() - commonlength);
+  textChopped2 = textChopped2.left(textChopped2.length() - commonlength);
+
+  // Compute the diff on the middle block.
+  // The chopped copies stay alive until diff_compute returns.
+  memory += (textChopped1.length() + textChopped2.length()) * sizeof(QChar);
+  diffs = diff_compute(textChopped1, textChopped2, checklines, deadline,
+                       memory);
+
+  // Restore the prefix and suffix.
+  if (!commonprefix.isEmpty()) {
+    diffs.prepend(Diff(EQUAL, commonprefix));
+  }
+  if (!commonsuffix.isEmpty()) {
+    diffs.append(Diff(EQUAL, commonsuffix));
+  }
+
+  diff_cleanupMerge(diffs);
+
+  return diffs;
+}
+
+
+QList<Diff> diff_match_patch::diff_compute(QString text1, QString text2,
+    bool checklines, clock_t deadline, qint64 memory) const {
+  QList<Diff> diffs;
+
+  if (text1.isEmpty()) {
+    // Just add some text (speedup).
+    diffs.append(Diff(INSERT, text2));
+    return diffs;
+  }
+
+  if (text2.isEmpty()) {
+    // Just delete some text (speedup).
+    diffs.append(Diff(DELETE, text1));
+    return diffs;
+  }
+
+  {
+    const QString longtext = text1.length() > text2.length() ? text1 : text2;
+    const QString shorttext = text1.length() > text2.length() ? text2 : text1;
+    const int i = TextSearch::indexOf(longtext, shorttext);
+    if (i != -1) {
+      // Shorter text is inside the longer text (speedup).
+      const Operation op = (text1.length() > text2.length()) ? DELETE : INSERT;
+      diffs.append(Diff(op, longtext.left(i)));
+      diffs.append(Diff(EQUAL, shorttext));
+      diffs.append(Diff(op, safeMid(longtext, i + shorttext.length())));
+      return diffs;
+    }
+
+    if (shorttext.length() == 1) {
+      // Single character string.
+      // After the previous speedup, the character can't be an equality.
+      diffs.append(Diff(DELETE, text1));
+      diffs.append(Diff(INSERT, text2));
+      return diffs;
+    }
+    // Garbage collect longtext and shorttext by scoping out.
+  }
+
+  // Check to see if the problem can be split in two.
+  const QStringList hm = diff_halfMatch(text1, text2);
+  if (hm.count() > 0) {
+    // A half-match was found, sort out the return data.
+    const QString text1_a = hm[0];
+    const QString text1_b = hm[1];
+    const QString text2_a = hm[2];
+    const QString text2_b = hm[3];
+    const QString mid_common = hm[4];
+    memory += (text1.length() + text2.length()) * sizeof(QChar);
+    // Send both pairs off for separate processing.
+    const QList<Diff> diffs_a = diff_main(text1_a, text2_a,
+                                          checklines, deadline, memory);
+    const QList<Diff> diffs_b = diff_main(text1_b, text2_b,
+                                          checklines, deadline, memory);
+    // Merge the results.
+    diffs = diffs_a;
+    diffs.append(Diff(EQUAL, mid_common));
+    diffs += diffs_b;
+    return diffs;
+  }
+
+  // Perform a real diff.
+  if (checklines && text1.length() > 100 && text2.length() > 100) {
+    return diff_lineMode(text1, text2, deadline, memory);
+  }
+
+  if (diff_overBudget(memory, diff_bisectMemory(text1, text2))) {
+    if (checklines) {
+      // Too big for a character diff, settle for a line diff.
+      return diff_lineMode(text1, text2, deadline, memory);
+    }
+    // Too big even at this granularity, replace the whole block.
+    diffs.append(Diff(DELETE, text1));
+    diffs.append(Diff(INSERT, text2));
+    return diffs;
+  }
+  return diff_bisect(text1, text2, deadline, memory);
+}
+
+
+QList<Diff> diff_match_patch::diff_lineMode(QString text1, QString text2,
+    clock_t deadline, qint64 memory) const {
+  // The line array holds one copy of every unique line.
+  memory += (text1.length() + text2.length()) * sizeof(QChar);
+  // Scan the text on a line-by-line basis first.
+  const QList<QVariant> b = diff_linesToChars(text1, text2);
+  text1 = b[0].toString();
+  text2 = b[1].toString();
+  QStringList linearray = b[2].toStringList();
+
+  QList<Diff> diffs = diff_main(text1, text2, false, deadline, memory);
+
+  // Convert the diff back to original text.
+  diff_charsToLines(diffs, linearray);
+  // Eliminate freak matches (e.g. blank lines)
+  diff_cleanupSemantic(diffs);
+
+  // Rediff any replacement blocks, this time character-by-character.
+  // Add a dummy entry at the end.
+  diffs.append(Diff(EQUAL, ""));
+  int count_delete = 0;
+  int count_insert = 0;
+  QString text_delete = "";
+  QString text_insert = "";
+
+  QMutableListIterator<Diff> pointer(diffs);
+  Diff *thisDiff = pointer.hasNext() ? &pointer.next() : NULL;
+  while (thisDiff != NULL) {
+    switch (thisDiff->operation) {
+      case INSERT:
+        count_insert++;
+        text_insert += thisDiff->text;
+        break;
+      case DELETE:
         count_delete++;
         text_delete += thisDiff->text;
         break;
@@ -348,7 +1344,7 @@ QList<Diff> diff_match_patch::diff_lineMode(QString text1, QString text2,
             pointer.remove();
           }
           foreach(Diff newDiff,
-              diff_main(text_delete, text_insert, false, deadline)) {
+              diff_main(text_delete, text_insert, false, deadline, memory)) {
             pointer.insert(newDiff);
           }
         }
@@ -367,7 +1363,13 @@ QList<Diff> diff_match_patch::diff_lineMode(QString text1, QString text2,
 
 
 QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
-    const QString &text2, clock_t deadline) {
+    const QString &text2, clock_t deadline) const {
+  return diff_bisect(text1, text2, deadline, 0);
+}
+
+
+QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
+    const QString &text2, clock_t deadline, qint64 memory) const {
   // Cache the text lengths to prevent multiple calls.
   const int text1_length = text1.length();
   const int text2_length = text2.length();
@@ -429,7 +1431,7 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
             // Overlap detected.
             delete [] v1;
             delete [] v2;
-            return diff_bisectSplit(text1, text2, x1, y1, deadline);
+            return diff_bisectSplit(text1, text2, x1, y1, deadline, memory);
           }
         }
       }
@@ -468,7 +1470,7 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
             // Overlap detected.
             delete [] v1;
             delete [] v2;
-            return diff_bisectSplit(text1, text2, x1, y1, deadline);
+            return diff_bisectSplit(text1, text2, x1, y1, deadline, memory);
           }
         }
       }
@@ -485,21 +1487,36 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
 }
 
 QList<Diff> diff_match_patch::diff_bisectSplit(const QString &text1,
-    const QString &text2, int x, int y, clock_t deadline) {
+    const QString &text2, int x, int y, clock_t deadline,
+    qint64 memory) const {
   QString text1a = text1.left(x);
   QString text2a = text2.left(y);
   QString text1b = safeMid(text1, x);
   QString text2b = safeMid(text2, y);
+  memory += (text1.length() + text2.length()) * sizeof(QChar);
 
   // Compute both diffs serially.
-  QList<Diff> diffs = diff_main(text1a, text2a, false, deadline);
-  QList<Diff> diffsb = diff_main(text1b, text2b, false, deadline);
+  QList<Diff> diffs = diff_main(text1a, text2a, false, deadline, memory);
+  QList<Diff> diffsb = diff_main(text1b, text2b, false, deadline, memory);
 
   return diffs + diffsb;
 }
 
+
+qint64 diff_match_patch::diff_bisectMemory(const QString &text1,
+                                           const QString &text2) {
+  // Two vectors of 2 * max_d ints, see diff_bisect.
+  const qint64 max_d = (text1.length() + text2.length() + 1) / 2;
+  return 2 * (2 * max_d) * static_cast<qint64>(sizeof(int));
+}
+
+
+bool diff_match_patch::diff_overBudget(qint64 memory, qint64 cost) const {
+  return Diff_MaxMemory > 0 && memory + cost > Diff_MaxMemory;
+}
+
 QList<QVariant> diff_match_patch::diff_linesToChars(const QString &text1,
-                                                    const QString &text2) {
+                                                    const QString &text2) const {
   QStringList lineArray;
   QMap<QString, int> lineHash;
   // e.g. linearray[4] == "Hello\n"
@@ -522,7 +1539,7 @@ QList<QVariant> diff_match_patch::diff_linesToChars(const QString &text1,
 
 QString diff_match_patch::diff_linesToCharsMunge(const QString &text,
                                                  QStringList &lineArray,
-                                                 QMap<QString, int> &lineHash) {
+                                                 QMap<QString, int> &lineHash) const {
   int lineStart = 0;
   int lineEnd = -1;
   QString line;
@@ -552,7 +1569,7 @@ QString diff_match_patch::diff_linesToCharsMunge(const QString &text,
 
 
 void diff_match_patch::diff_charsToLines(QList<Diff> &diffs,
-                                         const QStringList &lineArray) {
+                                         const QStringList &lineArray) const {
   // Qt has no mutable foreach construct.
   QMutableListIterator<Diff> i(diffs);
   while (i.hasNext()) {
@@ -567,7 +1584,7 @@ void diff_match_patch::diff_charsToLines(QList<Diff> &diffs,
 
 
 int diff_match_patch::diff_commonPrefix(const QString &text1,
-                                        const QString &text2) {
+                                        const QString &text2) const {
   // Performance analysis: http://neil.fraser.name/news/2007/10/09/
   const int n = std::min(text1.length(), text2.length());
   for (int i = 0; i < n; i++) {
@@ -580,7 +1597,7 @@ int diff_match_patch::diff_commonPrefix(const QString &text1,
 
 
 int diff_match_patch::diff_commonSuffix(const QString &text1,
-                                        const QString &text2) {
+                                        const QString &text2) const {
   // Performance analysis: http://neil.fraser.name/news/2007/10/09/
   const int text1_length = text1.length();
   const int text2_length = text2.length();
@@ -594,7 +1611,7 @@ int diff_match_patch::diff_commonSuffix(const QString &text1,
 }
 
 int diff_match_patch::diff_commonOverlap(const QString &text1,
-                                         const QString &text2) {
+                                         const QString &text2) const {
   // Cache the text lengths to prevent multiple calls.
   const int text1_length = text1.length();
   const int text2_length = text2.length();
@@ -623,7 +1640,7 @@ int diff_match_patch::diff_commonOverlap(const QString &text1,
   int length = 1;
   while (true) {
     QString pattern = text1_trunc.right(length);
-    int found = text2_trunc.indexOf(pattern);
+    int found = TextSearch::indexOf(text2_trunc, pattern);
     if (found == -1) {
       return best;
     }
@@ -636,7 +1653,7 @@ int diff_match_patch::diff_commonOverlap(const QString &text1,
 }
 
 QStringList diff_match_patch::diff_halfMatch(const QString &text1,
-                                             const QString &text2) {
+                                             const QString &text2) const {
   if (Diff_Timeout <= 0) {
     // Don't risk returning a non-optimal diff if we have unlimited time.
     return QStringList();
@@ -678,14 +1695,14 @@ QStringList diff_match_patch::diff_halfMatch(const QString &text1,
 
 QStringList diff_match_patch::diff_halfMatchI(const QString &longtext,
                                               const QString &shorttext,
-                                              int i) {
+                                              int i) const {
   // Start with a 1/4 length substring at position i as a seed.
   const QString seed = safeMid(longtext, i, longtext.length() / 4);
   int j = -1;
   QString best_common;
   QString best_longtext_a, best_longtext_b;
   QString best_shorttext_a, best_shorttext_b;
-  while ((j = shorttext.indexOf(seed, j + 1)) != -1) {
+  while ((j = TextSearch::indexOf(shorttext, seed, j + 1)) != -1) {
     const int prefixLength = diff_commonPrefix(safeMid(longtext, i),
         safeMid(shorttext, j));
     const int suffixLength = diff_commonSuffix(longtext.left(i),
@@ -710,7 +1727,7 @@ QStringList diff_match_patch::diff_halfMatchI(const QString &longtext,
 }
 
 
-void diff_match_patch::diff_cleanupSemantic(QList<Diff> &diffs) {
+void diff_match_patch::diff_cleanupSemantic(QList<Diff> &diffs) const {
   if (diffs.isEmpty()) {
     return;
   }
@@ -853,7 +1870,7 @@ void diff_match_patch::diff_cleanupSemantic(QList<Diff> &diffs) {
 }
 
 
-void diff_match_patch::diff_cleanupSemanticLossless(QList<Diff> &diffs) {
+void diff_match_patch::diff_cleanupSemanticLossless(QList<Diff> &diffs) const {
   QString equality1, edit, equality2;
   QString commonString;
   int commonOffset;
@@ -935,7 +1952,7 @@ void diff_match_patch::diff_cleanupSemanticLossless(QList<Diff> &diffs) {
 
 
 int diff_match_patch::diff_cleanupSemanticScore(const QString &one,
-                                                const QString &two) {
+                                                const QString &two) const {
   if (one.isEmpty() || two.isEmpty()) {
     // Edges are the best.
     return 6;
@@ -954,8 +1971,8 @@ int diff_match_patch::diff_cleanupSemanticScore(const QString &one,
   bool whitespace2 = nonAlphaNumeric2 && char2.isSpace();
   bool lineBreak1 = whitespace1 && char1.category() == QChar::Other_Control;
   bool lineBreak2 = whitespace2 && char2.category() == QChar::Other_Control;
-  bool blankLine1 = lineBreak1 && BLANKLINEEND.indexIn(one) != -1;
-  bool blankLine2 = lineBreak2 && BLANKLINESTART.indexIn(two) != -1;
+  bool blankLine1 = lineBreak1 && diff_blankLineEnd(one);
+  bool blankLine2 = lineBreak2 && diff_blankLineStart(two);
 
   if (blankLine1 || blankLine2) {
     // Five points for blank lines.
@@ -977,12 +1994,40 @@ int diff_match_patch::diff_cleanupSemanticScore(const QString &one,
 }
 
 
-// Define some regex patterns for matching boundaries.
-QRegExp diff_match_patch::BLANKLINEEND = QRegExp("\\n\\r?\\n$");
-QRegExp diff_match_patch::BLANKLINESTART = QRegExp("^\\r?\\n\\r?\\n");
+// Match boundaries by hand rather than with shared QRegExp objects; a QRegExp
+// caches its last match, so a static one is not safe to use from two threads.
+bool diff_match_patch::diff_blankLineEnd(const QString &text) {
+  // \n\r?\n$
+  const int n = text.length();
+  if (n < 2 || text[n - 1] != QChar('\n')) {
+    return false;
+  }
+  if (text[n - 2] == QChar('\n')) {
+    return true;
+  }
+  return n >= 3 && text[n - 2] == QChar('\r') && text[n - 3] == QChar('\n');
+}
 
 
-void diff_match_patch::diff_cleanupEfficiency(QList<Diff> &diffs) {
+bool diff_match_patch::diff_blankLineStart(const QString &text) {
+  // ^\r?\n\r?\n
+  const int n = text.length();
+  int i = 0;
+  if (i < n && text[i] == QChar('\r')) {
+    i++;
+  }
+  if (i >= n || text[i] != QChar('\n')) {
+    return false;
+  }
+  i++;
+  if (i < n && text[i] == QChar('\r')) {
+    i++;
+  }
+  return i < n && text[i] == QChar('\n');
+}
+
+
+void diff_match_patch::diff_cleanupEfficiency(QList<Diff> &diffs) const {
   if (diffs.isEmpty()) {
     return;
   }
@@ -1090,7 +2135,7 @@ void diff_match_patch::diff_cleanupEfficiency(QList<Diff> &diffs) {
 }
 
 
-void diff_match_patch::diff_cleanupMerge(QList<Diff> &diffs) {
+void diff_match_patch::diff_cleanupMerge(QList<Diff> &diffs) const {
   diffs.append(Diff(EQUAL, ""));  // Add a dummy entry at the end.
   QMutableListIterator<Diff> pointer(diffs);
   int count_delete = 0;
@@ -1238,13 +2283,13 @@ void diff_match_patch::diff_cleanupMerge(QList<Diff> &diffs) {
 }
 
 
-int diff_match_patch::diff_xIndex(const QList<Diff> &diffs, int loc) {
+int diff_match_patch::diff_xIndex(const QList<Diff> &diffs, int loc) const {
   int chars1 = 0;
   int chars2 = 0;
   int last_chars1 = 0;
   int last_chars2 = 0;
-  Diff lastDiff;
-  foreach(Diff aDiff, diffs) {
+  Operation lastOperation = EQUAL;
+  foreach(const Diff &aDiff, diffs) {
     if (aDiff.operation != INSERT) {
       // Equality or deletion.
       chars1 += aDiff.text.length();
@@ -1255,69 +2300,246 @@ int diff_match_patch::diff_xIndex(const QList<Diff> &diffs, int loc) {
     }
     if (chars1 > loc) {
       // Overshot the location.
-      lastDiff = aDiff;
+      lastOperation = aDiff.operation;
       break;
     }
     last_chars1 = chars1;
     last_chars2 = chars2;
   }
-  if (lastDiff.operation == DELETE) {
+  if (lastOperation == DELETE) {
     // The location was deleted.
     return last_chars2;
   }
-  // Add the remaining character length.
-  return last_chars2 + (loc - last_chars1);
+  // Add the remaining character length.
+  return last_chars2 + (loc - last_chars1);
+}
+
+
+/**
+ * Markup opening a diff of the given operation in diff_prettyHtml().
+ * @param op One of INSERT, DELETE or EQUAL.
+ * @return Opening tag.
+ */
+static const char *htmlOpenTag(Operation op) {
+  switch (op) {
+    case INSERT:
+      return "<ins style=\"background:#e6ffe6;\">";
+    case DELETE:
+      return "<del style=\"background:#ffe6e6;\">";
+    case EQUAL:
+      break;
+  }
+  return "<span>";
+}
+
+
+/**
+ * Markup closing a diff of the given operation in diff_prettyHtml().
+ * @param op One of INSERT, DELETE or EQUAL.
+ * @return Closing tag.
+ */
+static const char *htmlCloseTag(Operation op) {
+  switch (op) {
+    case INSERT:
+      return "</ins>";
+    case DELETE:
+      return "</del>";
+    case EQUAL:
+      break;
+  }
+  return "</span>";
+}
+
+
+/**
+ * Length of a text once escaped by appendHtmlEscaped().
+ * @param text The text to be escaped.
+ * @return Number of escaped characters.
+ */
+static int htmlEscapedLength(const QString &text) {
+  const QChar *chars = text.unicode();
+  int length = text.length();
+  for (int i = 0; i < text.length(); i++) {
+    switch (chars[i].unicode()) {
+      case '&':
+        length += 4;  // "&amp;"
+        break;
+      case '<':
+      case '>':
+        length += 3;  // "&lt;" or "&gt;"
+        break;
+      case '\n':
+        length += 9;  // "&para;<br>"
+        break;
+    }
+  }
+  return length;
+}
+
+
+/**
+ * Append characters to a string, escaped for HTML in a single pass.
+ * Newlines become a pilcrow and a line break.
+ * @param html The string to append to.
+ * @param chars Characters to escape.
+ * @param length Number of characters.
+ */
+static void appendHtmlEscaped(QString &html, const QChar *chars, int length) {
+  for (int i = 0; i < length; i++) {
+    switch (chars[i].unicode()) {
+      case '&':
+        html.append("&amp;");
+        break;
+      case '<':
+        html.append("&lt;");
+        break;
+      case '>':
+        html.append("&gt;");
+        break;
+      case '\n':
+        html.append("&para;<br>");
+        break;
+      default:
+        html.append(chars[i]);
+    }
+  }
+}
+
+
+// Context for writeToDevice(): the device and whether all writes succeeded.
+struct WriteState {
+  QIODevice *device;
+  bool ok;
+};
+
+
+/**
+ * TextSink which writes each chunk to a QIODevice as UTF-8.
+ * @param chunk The next piece of output.
+ * @param context A WriteState.
+ */
+static void writeToDevice(const QString &chunk, void *context) {
+  WriteState *state = static_cast<WriteState *>(context);
+  if (state->ok) {
+    const QByteArray bytes = chunk.toUtf8();
+    state->ok = state->device->write(bytes) == bytes.size();
+  }
+}
+
+
+// Out-of-class definition, for any use that binds a reference to it.
+const int diff_match_patch::SINK_CHUNK;
+
+// Characters of text escaped for HTML at a time; "&para;<br>" is the
+// longest escape of one character.
+static const int HTML_RUN = diff_match_patch::SINK_CHUNK / 10;
+
+// Characters of text percent-encoded at a time; "%E4%B8%AD" is the
+// longest encoding of one character.
+static const int PERCENT_RUN = diff_match_patch::SINK_CHUNK / 9;
+
+
+QString diff_match_patch::diff_prettyHtml(const QList<Diff> &diffs) const {
+  // Size the output exactly before writing any of it.
+  int length = 0;
+  foreach(const Diff &aDiff, diffs) {
+    length += int(strlen(htmlOpenTag(aDiff.operation)))
+        + htmlEscapedLength(aDiff.text)
+        + int(strlen(htmlCloseTag(aDiff.operation)));
+  }
+  QString html;
+  html.reserve(length);
+  foreach(const Diff &aDiff, diffs) {
+    html.append(htmlOpenTag(aDiff.operation));
+    appendHtmlEscaped(html, aDiff.text.unicode(), aDiff.text.length());
+    html.append(htmlCloseTag(aDiff.operation));
+  }
+  return html;
+}
+
+
+bool diff_match_patch::diff_prettyHtml(const QList<Diff> &diffs,
+                                       QIODevice *device) const {
+  WriteState state;
+  state.device = device;
+  state.ok = true;
+  diff_prettyHtml(diffs, writeToDevice, &state);
+  return state.ok;
+}
+
+
+void diff_match_patch::diff_prettyHtml(const QList<Diff> &diffs,
+                                       TextSink sink, void *context) const {
+  QString chunk;
+  chunk.reserve(SINK_CHUNK);
+  foreach(const Diff &aDiff, diffs) {
+    chunk.append(htmlOpenTag(aDiff.operation));
+    const QChar *chars = aDiff.text.unicode();
+    const int length = aDiff.text.length();
+    int pointer = 0;
+    while (pointer < length) {
+      // Escape a run at a time, keeping surrogate pairs whole so that each
+      // chunk converts to UTF-8 on its own.
+      int end = std::min(length, pointer + HTML_RUN);
+      if (end < length && chars[end - 1].isHighSurrogate()) {
+        end++;
+      }
+      appendHtmlEscaped(chunk, chars + pointer, end - pointer);
+      pointer = end;
+      if (chunk.length() >= SINK_CHUNK) {
+        sink(chunk, context);
+        chunk.resize(0);
+      }
+    }
+    chunk.append(htmlCloseTag(aDiff.operation));
+    if (chunk.length() >= SINK_CHUNK) {
+      sink(chunk, context);
+      chunk.resize(0);
+    }
+  }
+  if (!chunk.isEmpty()) {
+    sink(chunk, context);
+  }
 }
 
 
-QString diff_match_patch::diff_prettyHtml(const QList<Diff> &diffs) {
-  QString html;
-  QString text;
-  foreach(Diff aDiff, diffs) {
-    text = aDiff.text;
-    text.replace("&", "&amp;").replace("<", "&lt;")
-        .replace(">", "&gt;").replace("\n", "&para;<br>");
-    switch (aDiff.operation) {
-      case INSERT:
-        html += QString("<ins style=\"background:#e6ffe6;\">") + text
-            + QString("</ins>");
-        break;
-      case DELETE:
-        html += QString("<del style=\"background:#ffe6e6;\">") + text
-            + QString("</del>");
-        break;
-      case EQUAL:
-        html += QString("<span>") + text + QString("</span>");
-        break;
+QString diff_match_patch::diff_text1(const QList<Diff> &diffs) const {
+  int length = 0;
+  foreach(const Diff &aDiff, diffs) {
+    if (aDiff.operation != INSERT) {
+      length += aDiff.text.length();
     }
   }
-  return html;
-}
-
-
-QString diff_match_patch::diff_text1(const QList<Diff> &diffs) {
   QString text;
-  foreach(Diff aDiff, diffs) {
+  text.reserve(length);
+  foreach(const Diff &aDiff, diffs) {
     if (aDiff.operation != INSERT) {
-      text += aDiff.text;
+      text.append(aDiff.text);
     }
   }
   return text;
 }
 
 
-QString diff_match_patch::diff_text2(const QList<Diff> &diffs) {
+QString diff_match_patch::diff_text2(const QList<Diff> &diffs) const {
+  int length = 0;
+  foreach(const Diff &aDiff, diffs) {
+    if (aDiff.operation != DELETE) {
+      length += aDiff.text.length();
+    }
+  }
   QString text;
-  foreach(Diff aDiff, diffs) {
+  text.reserve(length);
+  foreach(const Diff &aDiff, diffs) {
     if (aDiff.operation != DELETE) {
-      text += aDiff.text;
+      text.append(aDiff.text);
     }
   }
   return text;
 }
 
 
-int diff_match_patch::diff_levenshtein(const QList<Diff> &diffs) {
+int diff_match_patch::diff_levenshtein(const QList<Diff> &diffs) const {
   int levenshtein = 0;
   int insertions = 0;
   int deletions = 0;
@@ -1342,143 +2564,881 @@ int diff_match_patch::diff_levenshtein(const QList<Diff> &diffs) {
 }
 
 
-QString diff_match_patch::diff_toDelta(const QList<Diff> &diffs) {
+int diff_match_patch::diff_distance(const QString &text1,
+                                    const QString &text2) const {
+  return diff_distance(text1, text2, -1);
+}
+
+
+int diff_match_patch::diff_distance(const QString &text1,
+    const QString &text2, int maxDistance) const {
+  // The shorter text forms the rows (bit positions), the longer the columns.
+  const bool swap = text1.length() > text2.length();
+  const QString &pattern = swap ? text2 : text1;
+  const QString &text = swap ? text1 : text2;
+  const int m = pattern.length();
+  const int n = text.length();
+  const int bound = maxDistance < 0 ? std::numeric_limits<int>::max()
+      : maxDistance;
+  if (n - m > bound) {
+    // The length difference alone is too much.
+    return -1;
+  }
+  if (m == 0) {
+    return n;
+  }
+
+  // Map each character of the pattern to a symbol number.  Symbol 0 is for
+  // characters which do not appear in the pattern.
+  int ascii[128];
+  std::fill(ascii, ascii + 128, 0);
+  QMap<QChar, int> others;
+  int symbols = 1;
+  for (int i = 0; i < m; i++) {
+    const QChar c = pattern[i];
+    if (c.unicode() < 128) {
+      if (ascii[c.unicode()] == 0) {
+        ascii[c.unicode()] = symbols++;
+      }
+    } else if (!others.contains(c)) {
+      others.insert(c, symbols++);
+    }
+  }
+
+  // Match masks: bit i of word w is set if pattern[64 * w + i] is the symbol.
+  const int words = (m + 63) / 64;
+  QVector<quint64> peq(symbols * words, 0);
+  for (int i = 0; i < m; i++) {
+    const QChar c = pattern[i];
+    const int symbol = c.unicode() < 128 ? ascii[c.unicode()]
+        : others.value(c);
+    peq[symbol * words + i / 64] |= static_cast<quint64>(1) << (i % 64);
+  }
+
+  // Vertical deltas of the current column, as positive and negative bits.
+  // Column 0 is 0, 1, 2, ... so every delta starts as +1.
+  QVector<quint64> pv(words, ~static_cast<quint64>(0));
+  QVector<quint64> mv(words, 0);
+  // Value of the bottom row of each block in the current column.
+  QVector<int> score(words);
+  for (int w = 0; w < words; w++) {
+    score[w] = std::min(64 * (w + 1), m);
+  }
+  const quint64 highBit = static_cast<quint64>(1) << 63;
+  const quint64 lastBit = static_cast<quint64>(1) << ((m - 1) % 64);
+
+  for (int j = 0; j < n; j++) {
+    const QChar c = text[j];
+    const int symbol = c.unicode() < 128 ? ascii[c.unicode()]
+        : others.value(c, 0);
+    const quint64 *eqs = peq.constData() + symbol * words;
+    // The top row is 0, 1, 2, ... so it always steps up by one.
+    int hin = 1;
+    // Lower bound on the smallest value anywhere in this column.  Costs never
+    // decrease along a path, so the final distance is at least this.
+    int lowest = j + 1;
+    for (int w = 0; w < words; w++) {
+      quint64 eq = eqs[w];
+      const quint64 pvw = pv[w];
+      const quint64 mvw = mv[w];
+      const quint64 xv = eq | mvw;
+      if (hin < 0) {
+        eq |= 1;
+      }
+      const quint64 xh = (((eq & pvw) + pvw) ^ pvw) | eq;
+      quint64 ph = mvw | ~(xh | pvw);
+      quint64 mh = pvw & xh;
+      // Horizontal delta at the bottom row of this block.
+      const quint64 bottom = (w == words - 1) ? lastBit : highBit;
+      const int hout = (ph & bottom) ? 1 : ((mh & bottom) ? -1 : 0);
+      ph <<= 1;
+      mh <<= 1;
+      if (hin < 0) {
+        mh |= 1;
+      } else if (hin > 0) {
+        ph |= 1;
+      }
+      pv[w] = mh | ~(xv | ph);
+      mv[w] = ph & xv;
+      score[w] += hout;
+      hin = hout;
+      // Neighbouring rows differ by at most one.
+      const int rows = std::min(64, m - 64 * w);
+      lowest = std::min(lowest, score[w] - rows + 1);
+    }
+    // The bottom row can drop by at most one per remaining column.
+    if (lowest > bound || score[words - 1] - (n - j - 1) > bound) {
+      return -1;
+    }
+  }
+  return score[words - 1] > bound ? -1 : score[words - 1];
+}
+
+
+QString diff_match_patch::diff_toDelta(const QList<Diff> &diffs) const {
+  // Size the output exactly: an operation character, a payload and a tab
+  // per diff.
+  int length = 0;
+  foreach(const Diff &aDiff, diffs) {
+    if (aDiff.operation == INSERT) {
+      length += 2 + percentEncodedLength(aDiff.text);
+    } else {
+      length += 2 + decimalLength(aDiff.text.length());
+    }
+  }
   QString text;
-  foreach(Diff aDiff, diffs) {
+  text.reserve(length);
+  foreach(const Diff &aDiff, diffs) {
     switch (aDiff.operation) {
-      case INSERT: {
-        QString encoded = QString(QUrl::toPercentEncoding(aDiff.text,
-            " !~*'();/?:@&=+$,#"));
-        text += QString("+") + encoded + QString("\t");
+      case INSERT:
+        text.append('+');
+        appendPercentEncoded(text, aDiff.text.unicode(), aDiff.text.length());
         break;
-      }
       case DELETE:
-        text += QString("-") + QString::number(aDiff.text.length())
-            + QString("\t");
+        text.append('-');
+        appendDecimal(text, aDiff.text.length());
         break;
       case EQUAL:
-        text += QString("=") + QString::number(aDiff.text.length())
-            + QString("\t");
+        text.append('=');
+        appendDecimal(text, aDiff.text.length());
         break;
     }
+    text.append('\t');
   }
   if (!text.isEmpty()) {
     // Strip off trailing tab character.
-    text = text.left(text.length() - 1);
+    text.chop(1);
   }
   return text;
 }
 
 
 QList<Diff> diff_match_patch::diff_fromDelta(const QString &text1,
-                                             const QString &delta) {
+                                             const QString &delta) const {
+  return diff_fromDelta(text1, delta, NULL);
+}
+
+
+QList<Diff> diff_match_patch::diff_fromDelta(const QString &text1,
+    const QString &delta, QVector<int> *lengths) const {
   QList<Diff> diffs;
   int pointer = 0;  // Cursor in text1
-  QStringList tokens = delta.split("\t");
-  foreach(QString token, tokens) {
-    if (token.isEmpty()) {
+  const QChar *chars = delta.unicode();
+  const int length = delta.length();
+  // Walk the tab-separated tokens in place.
+  int tokenStart = 0;
+  while (tokenStart < length) {
+    int tokenEnd = delta.indexOf('\t', tokenStart);
+    if (tokenEnd == -1) {
+      tokenEnd = length;
+    }
+    if (tokenEnd == tokenStart) {
       // Blank tokens are ok (from a trailing \t).
+      tokenStart++;
       continue;
     }
     // Each token begins with a one character parameter which specifies the
     // operation of this token (delete, insert, equality).
-    QString param = safeMid(token, 1);
-    switch (token[0].toAscii()) {
+    const QChar *param = chars + tokenStart + 1;
+    const int paramLength = tokenEnd - tokenStart - 1;
+    const QChar op = chars[tokenStart];
+    switch (op.unicode()) {
       case '+':
-        param = QUrl::fromPercentEncoding(qPrintable(param));
-        diffs.append(Diff(INSERT, param));
+        diffs.append(Diff(INSERT, percentDecoded(param, paramLength)));
+        if (lengths != NULL) {
+          lengths->append(diffs.last().text.length());
+        }
         break;
       case '-':
         // Fall through.
       case '=': {
-        int n;
-        n = param.toInt();
-        if (n < 0) {
-          throw QString("Negative number in diff_fromDelta: %1").arg(param);
+        if (paramLength > 0 && param[0] == QChar('-')) {
+          throw QString("Negative number in diff_fromDelta: %1")
+              .arg(QString(param, paramLength));
+        }
+        // Parse the length in place, rejecting anything but digits.
+        bool valid = paramLength > 0;
+        int n = 0;
+        for (int i = 0; valid && i < paramLength; i++) {
+          const int digit = param[i].unicode() - '0';
+          valid = digit >= 0 && digit <= 9
+              && n <= (std::numeric_limits<int>::max() - digit) / 10;
+          if (valid) {
+            n = n * 10 + digit;
+          }
+        }
+        if (!valid) {
+          throw QString("Invalid number in diff_fromDelta: %1")
+              .arg(QString(param, paramLength));
         }
-        QString text;
-        text = safeMid(text1, pointer, n);
+        if (lengths != NULL) {
+          diffs.append(Diff(op == QChar('=') ? EQUAL : DELETE, QString()));
+          lengths->append(n);
+          break;
+        }
+        if (n > text1.length() - pointer) {
+          throw QString("Delta length (%1) larger than source text length (%2)")
+              .arg(pointer + n).arg(text1.length());
+        }
+        diffs.append(Diff(op == QChar('=') ? EQUAL : DELETE,
+                          text1.mid(pointer, n)));
         pointer += n;
-        if (token[0] == QChar('=')) {
-          diffs.append(Diff(EQUAL, text));
-        } else {
-          diffs.append(Diff(DELETE, text));
+        break;
+      }
+      default:
+        throw QString("Invalid diff operation in diff_fromDelta: %1").arg(op);
+    }
+    tokenStart = tokenEnd + 1;
+  }
+  if (lengths == NULL && pointer != text1.length()) {
+    throw QString("Delta length (%1) smaller than source text length (%2)")
+        .arg(pointer).arg(text1.length());
+  }
+  return diffs;
+}
+
+
+QList<Diff> diff_match_patch::diff_compose(const QList<Diff> &diffsAB,
+                                           const QList<Diff> &diffsBC) const {
+  QVector<int> lengthsBC;
+  lengthsBC.reserve(diffsBC.size());
+  foreach(const Diff &aDiff, diffsBC) {
+    lengthsBC.append(aDiff.text.length());
+  }
+  return diff_compose(diffsAB, diffsBC, lengthsBC);
+}
+
+
+QString diff_match_patch::diff_compose(const QString &text1,
+                                       const QString &deltaAB,
+                                       const QString &deltaBC) const {
+  QVector<int> lengthsBC;
+  const QList<Diff> diffsBC = diff_fromDelta(QString(), deltaBC, &lengthsBC);
+  return diff_toDelta(diff_compose(diff_fromDelta(text1, deltaAB), diffsBC,
+                                   lengthsBC));
+}
+
+
+QList<Diff> diff_match_patch::diff_compose(const QList<Diff> &diffsAB,
+                                           const QList<Diff> &diffsBC,
+                                           const QVector<int> &lengthsBC) const {
+  QList<Diff> diffs;
+  // Walk both diffs through B.  A deletion from A and an insertion into C
+  // take no room in B; everything else consumes B in step.
+  int indexAB = 0;
+  int indexBC = 0;
+  int offsetAB = 0;  // Characters of diffsAB[indexAB] already consumed.
+  int offsetBC = 0;  // Characters of diffsBC[indexBC] already consumed.
+  while (indexAB < diffsAB.size() || indexBC < diffsBC.size()) {
+    if (indexAB < diffsAB.size() && diffsAB[indexAB].operation == DELETE) {
+      diffs.append(diffsAB[indexAB++]);
+      continue;
+    }
+    if (indexBC < diffsBC.size() && diffsBC[indexBC].operation == INSERT) {
+      diffs.append(diffsBC[indexBC++]);
+      continue;
+    }
+    if (indexAB < diffsAB.size() && diffsAB[indexAB].text.isEmpty()) {
+      indexAB++;
+      continue;
+    }
+    if (indexBC < diffsBC.size() && lengthsBC[indexBC] == 0) {
+      indexBC++;
+      continue;
+    }
+    if (indexAB == diffsAB.size() || indexBC == diffsBC.size()) {
+      throw QString("Diffs disagree on the length of the middle text");
+    }
+    const Diff &diffAB = diffsAB[indexAB];
+    const int length = std::min(diffAB.text.length() - offsetAB,
+                                lengthsBC[indexBC] - offsetBC);
+    const bool kept = diffsBC[indexBC].operation == EQUAL;
+    if (diffAB.operation == EQUAL) {
+      // Text of A which B kept: C keeps or deletes it.
+      diffs.append(Diff(kept ? EQUAL : DELETE,
+                        diffAB.text.mid(offsetAB, length)));
+    } else if (kept) {
+      // Text inserted by B which C kept.
+      diffs.append(Diff(INSERT, diffAB.text.mid(offsetAB, length)));
+    }
+    // Text inserted by B and deleted by C never existed for A to C.
+    offsetAB += length;
+    offsetBC += length;
+    if (offsetAB == diffAB.text.length()) {
+      indexAB++;
+      offsetAB = 0;
+    }
+    if (offsetBC == lengthsBC[indexBC]) {
+      indexBC++;
+      offsetBC = 0;
+    }
+  }
+  diff_cleanupMerge(diffs);
+  return diffs;
+}
+
+// Version byte which starts every binary delta.
+static const char BINARY_DELTA_VERSION = 1;
+
+
+/**
+ * Write an unsigned varint: 7 bits per byte, least significant first, the
+ * high bit set on every byte but the last.
+ * @param out Where to write; needs room for 10 bytes.
+ * @param value The value.
+ * @return Pointer just past the varint.
+ */
+static char *writeVarint(char *out, quint64 value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<char>(value);
+  return out;
+}
+
+
+/**
+ * Write UTF-16 text as UTF-8, unpaired surrogates becoming '?' as in
+ * QString::toUtf8().
+ * @param out Where to write; needs room for 3 bytes per character.
+ * @param chars Characters to convert.
+ * @param length Number of characters.
+ * @return Pointer just past the UTF-8.
+ */
+static char *writeUtf8(char *out, const QChar *chars, int length) {
+  for (int i = 0; i < length; i++) {
+    uint c = chars[i].unicode();
+    if (c < 0x80) {
+      *out++ = static_cast<char>(c);
+    } else if (c < 0x800) {
+      *out++ = static_cast<char>(0xc0 | (c >> 6));
+      *out++ = static_cast<char>(0x80 | (c & 0x3f));
+    } else if (c < 0xd800 || c >= 0xe000) {
+      *out++ = static_cast<char>(0xe0 | (c >> 12));
+      *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      *out++ = static_cast<char>(0x80 | (c & 0x3f));
+    } else if (c < 0xdc00 && i + 1 < length && chars[i + 1].isLowSurrogate()) {
+      c = 0x10000 + ((c - 0xd800) << 10) + (chars[i + 1].unicode() - 0xdc00);
+      i++;
+      *out++ = static_cast<char>(0xf0 | (c >> 18));
+      *out++ = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+      *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      *out++ = static_cast<char>(0x80 | (c & 0x3f));
+    } else {
+      *out++ = '?';
+    }
+  }
+  return out;
+}
+
+
+/**
+ * Read an unsigned varint written by writeVarint().
+ * @param pointer Cursor, advanced past the varint.
+ * @param end End of the data.
+ * @param value Receives the value.
+ * @return False if the data ends inside the varint, it is too long, or it
+ *     does not fit in 64 bits.
+ */
+static bool readVarint(const uchar *&pointer, const uchar *end,
+                       quint64 &value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && pointer != end; shift += 7) {
+    const uchar byte = *pointer++;
+    if (shift == 63 && (byte & 0x7e)) {
+      // The tenth byte holds only bit 63.
+      return false;
+    }
+    value |= static_cast<quint64>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+QByteArray diff_match_patch::diff_toBinaryDelta(const QList<Diff> &diffs) const {
+  // Size for the worst case: a 10 byte varint per diff and 3 UTF-8 bytes per
+  // inserted character.  Trimmed once written.
+  int length = 1;
+  foreach(const Diff &aDiff, diffs) {
+    length += 10 + (aDiff.operation == INSERT ? 3 * aDiff.text.length() : 0);
+  }
+  QByteArray delta;
+  delta.resize(length);
+  char *out = delta.data();
+  *out++ = BINARY_DELTA_VERSION;
+  foreach(const Diff &aDiff, diffs) {
+    switch (aDiff.operation) {
+      case INSERT: {
+        // Write the text first, then slot its byte count in front of it.
+        char header[10];
+        char *text = out + 10;
+        const quint64 size = writeUtf8(text, aDiff.text.unicode(),
+                                       aDiff.text.length()) - text;
+        const int headerLength = writeVarint(header, (size << 2) | 2) - header;
+        memcpy(out, header, headerLength);
+        memmove(out + headerLength, text, size);
+        out += headerLength + size;
+        break;
+      }
+      case DELETE:
+        out = writeVarint(out,
+            (static_cast<quint64>(aDiff.text.length()) << 2) | 1);
+        break;
+      case EQUAL:
+        out = writeVarint(out, static_cast<quint64>(aDiff.text.length()) << 2);
+        break;
+    }
+  }
+  delta.resize(out - delta.constData());
+  return delta;
+}
+
+
+QList<Diff> diff_match_patch::diff_fromBinaryDelta(const QString &text1,
+    const QByteArray &delta) const {
+  if (delta.isEmpty() || delta[0] != BINARY_DELTA_VERSION) {
+    throw QString("Unsupported binary delta version: %1")
+        .arg(delta.isEmpty() ? -1 : static_cast<uchar>(delta[0]));
+  }
+  QList<Diff> diffs;
+  int pointer = 0;  // Cursor in text1
+  const uchar *data = reinterpret_cast<const uchar *>(delta.constData()) + 1;
+  const uchar *end = data + delta.size() - 1;
+  while (data != end) {
+    quint64 value;
+    if (!readVarint(data, end, value)) {
+      throw QString("Truncated or invalid length in binary delta");
+    }
+    const quint64 length = value >> 2;
+    switch (value & 3) {
+      case 2:
+        if (length > static_cast<quint64>(end - data)) {
+          throw QString("Truncated insertion in binary delta");
+        }
+        diffs.append(Diff(INSERT, QString::fromUtf8(
+            reinterpret_cast<const char *>(data), static_cast<int>(length))));
+        data += length;
+        break;
+      case 1:
+        // Fall through.
+      case 0:
+        if (length > static_cast<quint64>(text1.length() - pointer)) {
+          throw QString("Binary delta longer than source text length (%1)")
+              .arg(text1.length());
+        }
+        diffs.append(Diff((value & 3) ? DELETE : EQUAL,
+                          text1.mid(pointer, static_cast<int>(length))));
+        pointer += static_cast<int>(length);
+        break;
+      default:
+        throw QString("Invalid diff operation in binary delta");
+    }
+  }
+  if (pointer != text1.length()) {
+    throw QString("Delta length (%1) smaller than source text length (%2)")
+        .arg(pointer).arg(text1.length());
+  }
+  return diffs;
+}
+
+
+  //  MATCH FUNCTIONS
+
+
+/**
+ * Compute one position of a bitap row from its neighbours.
+ * Each argument points at a bit vector of 'words' words, least significant
+ * first.
+ * @param row Receives the state at this position and error level.
+ * @param next State at the following position, same error level.
+ * @param last State at this position one error level down, followed by
+ *     the state at the following position; NULL on the exact level.
+ * @param charMatch Alphabet mask of the character at this position.
+ * @param words Words per bit vector.
+ */
+static inline void bitapRow(quint64 *row, const quint64 *next,
+                            const quint64 *last, const quint64 *charMatch,
+                            int words) {
+  // Shift left by one across the words, bringing in a 1.
+  quint64 carry = 1;
+  if (last == NULL) {
+    // First pass: exact match.
+    for (int w = 0; w < words; w++) {
+      row[w] = ((next[w] << 1) | carry) & charMatch[w];
+      carry = next[w] >> 63;
+    }
+  } else {
+    // Subsequent passes: fuzzy match.
+    const quint64 *last_next = last + words;
+    quint64 last_carry = 1;
+    for (int w = 0; w < words; w++) {
+      const quint64 either = last_next[w] | last[w];
+      row[w] = (((next[w] << 1) | carry) & charMatch[w])
+          | ((either << 1) | last_carry) | last_next[w];
+      carry = next[w] >> 63;
+      last_carry = either >> 63;
+    }
+  }
+}
+
+
+int diff_match_patch::match_main(const QString &text, const QString &pattern,
+                                 int loc) const {
+  QVector<quint64> rows;
+  return match_main(text, pattern, loc, rows);
+}
+
+
+int diff_match_patch::match_main(const QString &text, const QString &pattern,
+                                 int loc, QVector<quint64> &rows) const {
+  // Check for null inputs.
+  if (text.isNull() || pattern.isNull()) {
+    throw "Null inputs. (match_main)";
+  }
+
+  loc = std::max(0, std::min(loc, text.length()));
+  if (text == pattern) {
+    // Shortcut (potentially not guaranteed by the algorithm)
+    return 0;
+  } else if (text.isEmpty()) {
+    // Nothing to match.
+    return -1;
+  } else if (loc + pattern.length() <= text.length()
+      && safeMid(text, loc, pattern.length()) == pattern) {
+    // Perfect match at the perfect spot!  (Includes case of null pattern)
+    return loc;
+  } else {
+    // Do a fuzzy compare.
+    return match_bitap(text, pattern, loc, rows);
+  }
+}
+
+
+int diff_match_patch::match_main(const PreparedText &text,
+                                 const QString &pattern, int loc) const {
+  const QString &source = text.text();
+  // Check for null inputs.
+  if (source.isNull() || pattern.isNull()) {
+    throw "Null inputs. (match_main)";
+  }
+
+  loc = std::max(0, std::min(loc, source.length()));
+  if (source == pattern) {
+    // Shortcut (potentially not guaranteed by the algorithm)
+    return 0;
+  } else if (source.isEmpty()) {
+    // Nothing to match.
+    return -1;
+  } else if (loc + pattern.length() <= source.length()
+      && safeMid(source, loc, pattern.length()) == pattern) {
+    // Perfect match at the perfect spot!  (Includes case of null pattern)
+    return loc;
+  }
+  if (!(Match_MaxBits == 0 || pattern.length() <= Match_MaxBits)) {
+    throw "Pattern too long for this application.";
+  }
+
+  // A match with e errors keeps all but at most e * q of the pattern's
+  // q-grams, and cannot score under the threshold with more errors than this.
+  const int q = text.qgram();
+  const int errors = static_cast<int>(Match_Threshold * pattern.length()) + 1;
+  const int needed = pattern.length() - q + 1 - errors * q;
+  if (needed > 0) {
+    // How far from loc the bitap would look, as in its first pass.
+    int bin_min = 0;
+    int bin_max = pattern.length() + source.length();
+    int bin_mid = bin_max;
+    while (bin_min < bin_mid) {
+      if (match_bitapScore(0, loc + bin_mid, loc, pattern) <= Match_Threshold) {
+        bin_min = bin_mid;
+      } else {
+        bin_max = bin_mid;
+      }
+      bin_mid = (bin_max - bin_min) / 2 + bin_min;
+    }
+    if (text.sharedGrams(pattern, loc - bin_mid - 1,
+        loc + bin_mid + 2 * pattern.length() + errors) < needed) {
+      // Nothing there is close enough.
+      return -1;
+    }
+  }
+
+  // Is there a nearby exact match? (speedup)
+  const int after = text.indexOf(pattern, loc);
+  // What about in the other direction? (speedup)
+  const int before = after == -1 ? -1
+      : text.lastIndexOf(pattern, loc + pattern.length());
+  QVector<quint64> rows;
+  return match_bitap(source.unicode(), source.length(), pattern,
+                     MatchAlphabet(pattern), loc, after, before, Match_MaxBits,
+                     rows);
+}
+
+
+int diff_match_patch::match_main(TextBuffer &text, const QString &pattern,
+                                 const MatchAlphabet &alphabet, int loc,
+                                 int maxBits, QVector<quint64> &rows) const {
+  const int length = text.length();
+  const int m = pattern.length();
+  loc = std::max(0, std::min(loc, length));
+  // How far from loc the bitap can look: the furthest an exact match could
+  // lie and still score under the threshold.
+  int bin_min = 0;
+  int bin_max = m + length;
+  int reach = bin_max;
+  while (bin_min < reach) {
+    if (match_bitapScore(0, loc + reach, loc, pattern) <= Match_Threshold) {
+      bin_min = reach;
+    } else {
+      bin_max = reach;
+    }
+    reach = (bin_max - bin_min) / 2 + bin_min;
+  }
+  // The search reads no further than this, nor does the look back from
+  // loc + m.
+  const int end = std::min(length, loc + std::max(reach, m) + m);
+  const QChar *chars = text.prefix(end);
+
+  if (length == m && memcmp(chars, pattern.unicode(), m * sizeof(QChar)) == 0) {
+    // Shortcut (potentially not guaranteed by the algorithm)
+    return 0;
+  } else if (length == 0) {
+    // Nothing to match.
+    return -1;
+  } else if (loc + m <= length
+      && memcmp(chars + loc, pattern.unicode(), m * sizeof(QChar)) == 0) {
+    // Perfect match at the perfect spot!  (Includes case of null pattern)
+    return loc;
+  }
+
+  // Is there a nearby exact match? (speedup)  Any further away than reach
+  // could not lower the threshold.
+  int after = TextSearch::indexOf(chars, end, pattern.unicode(), m, loc);
+  // What about in the other direction? (speedup)
+  int before = -1;
+  const int from = std::min(loc + m, length - m);
+  const int first = std::max(0, loc - reach);
+  if (loc + m < length && from >= first) {
+    before = TextSearch::lastIndexOf(chars + first, end - first,
+                                     pattern.unicode(), m, from - first);
+    if (before != -1) {
+      before += first;
+    }
+  }
+  if (after == -1 && before != -1) {
+    // match_main() only looks back when there is a match after loc at all.
+    chars = text.prefix(length);
+    after = TextSearch::indexOf(chars, length, pattern.unicode(), m,
+                                std::max(loc, end - m + 1));
+    if (after == -1) {
+      before = -1;
+    }
+  }
+  return match_bitap(chars, length, pattern, alphabet, loc, after, before,
+                     maxBits, rows);
+}
+
+
+/**
+ * Find every exact occurrence of some equal-length patterns in one pass over
+ * a text, by rolling a polynomial hash along it.
+ * @param text The text to search.
+ * @param patterns Distinct patterns, all of the same non-zero length.
+ * @param occurrences Receives the ascending match positions of each pattern.
+ */
+static void findOccurrences(const QString &text, const QStringList &patterns,
+                            QVector<QVector<int> > &occurrences) {
+  const quint64 BASE = Q_UINT64_C(0x100000001b3);
+  const int length = patterns.first().length();
+  occurrences.fill(QVector<int>(), patterns.size());
+  if (length > text.length()) {
+    return;
+  }
+  // Hash of a string, and BASE^length to drop the character leaving the window.
+  quint64 drop = 1;
+  for (int k = 0; k < length; k++) {
+    drop *= BASE;
+  }
+  QHash<quint64, QList<int> > buckets;
+  for (int x = 0; x < patterns.size(); x++) {
+    quint64 hash = 0;
+    const QChar *chars = patterns[x].unicode();
+    for (int k = 0; k < length; k++) {
+      hash = hash * BASE + chars[k].unicode();
+    }
+    buckets[hash].append(x);
+  }
+
+  const QChar *chars = text.unicode();
+  quint64 hash = 0;
+  for (int k = 0; k < length; k++) {
+    hash = hash * BASE + chars[k].unicode();
+  }
+  for (int i = 0; ; i++) {
+    QHash<quint64, QList<int> >::const_iterator bucket = buckets.constFind(hash);
+    if (bucket != buckets.constEnd()) {
+      // At most one distinct pattern can match here; confirm it.
+      foreach (int x, bucket.value()) {
+        if (memcmp(chars + i, patterns[x].unicode(),
+                   length * sizeof(QChar)) == 0) {
+          occurrences[x].append(i);
+          break;
         }
-        break;
       }
-      default:
-        throw QString("Invalid diff operation in diff_fromDelta: %1")
-            .arg(token[0]);
     }
+    if (i + length == text.length()) {
+      break;
+    }
+    hash = hash * BASE - chars[i].unicode() * drop
+        + chars[i + length].unicode();
   }
-  if (pointer != text1.length()) {
-    throw QString("Delta length (%1) smaller than source text length (%2)")
-        .arg(pointer).arg(text1.length());
-  }
-  return diffs;
 }
 
 
-  //  MATCH FUNCTIONS
-
-
-int diff_match_patch::match_main(const QString &text, const QString &pattern,
-                                 int loc) {
+QList<int> diff_match_patch::match_many(const QString &text,
+                                        const QStringList &patterns,
+                                        const QList<int> &locs) const {
   // Check for null inputs.
-  if (text.isNull() || pattern.isNull()) {
-    throw "Null inputs. (match_main)";
+  if (text.isNull()) {
+    throw "Null inputs. (match_many)";
+  }
+  if (patterns.size() != locs.size()) {
+    throw "Need one location per pattern. (match_many)";
   }
 
-  loc = std::max(0, std::min(loc, text.length()));
-  if (text == pattern) {
-    // Shortcut (potentially not guaranteed by the algorithm)
-    return 0;
-  } else if (text.isEmpty()) {
-    // Nothing to match.
-    return -1;
-  } else if (loc + pattern.length() <= text.length()
-      && safeMid(text, loc, pattern.length()) == pattern) {
-    // Perfect match at the perfect spot!  (Includes case of null pattern)
-    return loc;
-  } else {
-    // Do a fuzzy compare.
-    return match_bitap(text, pattern, loc);
+  QList<int> results;
+  QVector<int> clamped(patterns.size());
+  // Patterns that need a fuzzy compare, grouped by length.
+  QMap<int, QList<int> > fuzzy;
+  for (int x = 0; x < patterns.size(); x++) {
+    const QString &pattern = patterns[x];
+    if (pattern.isNull()) {
+      throw "Null inputs. (match_many)";
+    }
+    // The shortcuts of match_main.
+    const int loc = std::max(0, std::min(locs[x], text.length()));
+    clamped[x] = loc;
+    if (text == pattern) {
+      results.append(0);
+    } else if (text.isEmpty()) {
+      results.append(-1);
+    } else if (loc + pattern.length() <= text.length()
+        && safeMid(text, loc, pattern.length()) == pattern) {
+      results.append(loc);
+    } else {
+      results.append(-1);
+      fuzzy[pattern.length()].append(x);
+    }
   }
+
+  QVector<quint64> rows;
+  QMapIterator<int, QList<int> > group(fuzzy);
+  while (group.hasNext()) {
+    group.next();
+    const QList<int> &members = group.value();
+    if (members.size() == 1) {
+      // Nothing to share; search as match_main would.
+      const int x = members.first();
+      results[x] = match_bitap(text, patterns[x], clamped[x], rows);
+      continue;
+    }
+    // One pass over the text finds the exact matches of the whole group.
+    QStringList distinct;
+    QHash<QString, int> ids;
+    foreach (int x, members) {
+      if (!ids.contains(patterns[x])) {
+        ids.insert(patterns[x], distinct.size());
+        distinct.append(patterns[x]);
+      }
+    }
+    QVector<QVector<int> > occurrences;
+    findOccurrences(text, distinct, occurrences);
+    foreach (int x, members) {
+      const QString &pattern = patterns[x];
+      const QVector<int> &found = occurrences[ids.value(pattern)];
+      const int loc = clamped[x];
+      // Same answers as indexOf(pattern, loc) and
+      // lastIndexOf(pattern, loc + length).
+      const int *next = std::lower_bound(found.constBegin(), found.constEnd(),
+                                         loc);
+      const int after = next == found.constEnd() ? -1 : *next;
+      int before = -1;
+      if (loc + pattern.length() < text.length()) {
+        const int *end = std::upper_bound(found.constBegin(), found.constEnd(),
+                                          loc + pattern.length());
+        if (end != found.constBegin()) {
+          before = *(end - 1);
+        }
+      }
+      results[x] = match_bitap(text.unicode(), text.length(), pattern,
+                               MatchAlphabet(pattern), loc, after, before,
+                               Match_MaxBits, rows);
+    }
+  }
+  return results;
 }
 
 
 int diff_match_patch::match_bitap(const QString &text, const QString &pattern,
-                                  int loc) {
-  if (!(Match_MaxBits == 0 || pattern.length() <= Match_MaxBits)) {
+                                  int loc) const {
+  QVector<quint64> rows;
+  return match_bitap(text, pattern, loc, rows);
+}
+
+
+int diff_match_patch::match_bitap(const QString &text, const QString &pattern,
+                                  int loc, QVector<quint64> &rows) const {
+  // Is there a nearby exact match? (speedup)
+  const int after = TextSearch::indexOf(text, pattern, loc);
+  // What about in the other direction? (speedup)
+  const int before = after == -1 ? -1
+      : TextSearch::lastIndexOf(text, pattern, loc + pattern.length());
+  return match_bitap(text.unicode(), text.length(), pattern,
+                     MatchAlphabet(pattern), loc, after, before, Match_MaxBits,
+                     rows);
+}
+
+
+int diff_match_patch::match_bitap(const QChar *text, int textLength,
+                                  const QString &pattern,
+                                  const MatchAlphabet &s, int loc, int after,
+                                  int before, int maxBits,
+                                  QVector<quint64> &rows) const {
+  if (!(maxBits == 0 || pattern.length() <= maxBits)) {
     throw "Pattern too long for this application.";
   }
 
-  // Initialise the alphabet.
-  QMap<QChar, int> s = match_alphabet(pattern);
-
   // Highest score beyond which we give up.
   double score_threshold = Match_Threshold;
-  // Is there a nearby exact match? (speedup)
-  int best_loc = text.indexOf(pattern, loc);
-  if (best_loc != -1) {
-    score_threshold = std::min(match_bitapScore(0, best_loc, loc, pattern),
+  if (after != -1) {
+    score_threshold = std::min(match_bitapScore(0, after, loc, pattern),
         score_threshold);
-    // What about in the other direction? (speedup)
-    best_loc = text.lastIndexOf(pattern, loc + pattern.length());
-    if (best_loc != -1) {
-      score_threshold = std::min(match_bitapScore(0, best_loc, loc, pattern),
+    if (before != -1) {
+      score_threshold = std::min(match_bitapScore(0, before, loc, pattern),
           score_threshold);
     }
   }
 
-  // Initialise the bit arrays.
-  int matchmask = 1 << (pattern.length() - 1);
-  best_loc = -1;
+  // Initialise the bit arrays.  Each row entry is a bit vector of 'words'
+  // 64-bit words, least significant first.
+  const int words = s.words();
+  const int matchword = (pattern.length() - 1) / 64;
+  const quint64 matchmask = Q_UINT64_C(1) << ((pattern.length() - 1) % 64);
+  int best_loc = -1;
 
   int bin_min, bin_mid;
-  int bin_max = pattern.length() + text.length();
-  int *rd;
-  int *last_rd = NULL;
+  int bin_max = pattern.length() + textLength;
+  // Two rows, this error level's and the last, reused for every level.
+  // They cover only the first level's window, from 'base' to its
+  // finish + 1: each later level searches within the one before, and a
+  // match past loc moves the start back no further than its mirror image.
+  int base = 0;
+  quint64 *rd = NULL;
+  quint64 *last_rd = NULL;
   for (int d = 0; d < pattern.length(); d++) {
     // Scan for the best match; each iteration allows for one more error.
     // Run a binary search to determine how far from 'loc' we can stray at
@@ -1497,28 +3457,36 @@ int diff_match_patch::match_bitap(const QString &text, const QString &pattern,
     // Use the result from this iteration as the maximum for the next.
     bin_max = bin_mid;
     int start = std::max(1, loc - bin_mid + 1);
-    int finish = std::min(loc + bin_mid, text.length()) + pattern.length();
+    int finish = std::min(loc + bin_mid, textLength) + pattern.length();
+    if (d == 0) {
+      base = std::max(1, std::min(start, 2 * loc - finish + 1));
+      const int rowLength = (finish + 2 - base) * words;
+      if (rows.size() < 2 * rowLength) {
+        rows.resize(2 * rowLength);
+      }
+      rd = rows.data();
+      last_rd = rd + rowLength;
+    }
 
-    rd = new int[finish + 2];
-    rd[finish + 1] = (1 << d) - 1;
+    // Clear the part of the row the next level may read, in case this
+    // level stops early.  Then seed it with d errors' worth of ones.
+    memset(rd, 0, (finish + 2 - base) * words * sizeof(quint64));
+    for (int w = 0; w <= d / 64; w++) {
+      rd[(finish + 1 - base) * words + w] = w < d / 64 ? ~Q_UINT64_C(0)
+          : (Q_UINT64_C(1) << (d % 64)) - 1;
+    }
     for (int j = finish; j >= start; j--) {
-      int charMatch;
-      if (text.length() <= j - 1) {
+      const quint64 *charMatch;
+      if (textLength <= j - 1) {
         // Out of range.
-        charMatch = 0;
-      } else {
-        charMatch = s.value(text[j - 1], 0);
-      }
-      if (d == 0) {
-        // First pass: exact match.
-        rd[j] = ((rd[j + 1] << 1) | 1) & charMatch;
+        charMatch = s.noMatch();
       } else {
-        // Subsequent passes: fuzzy match.
-        rd[j] = ((rd[j + 1] << 1) | 1) & charMatch
-            | (((last_rd[j + 1] | last_rd[j]) << 1) | 1)
-            | last_rd[j + 1];
+        charMatch = s.mask(text[j - 1]);
       }
-      if ((rd[j] & matchmask) != 0) {
+      quint64 *row = rd + (j - base) * words;
+      const quint64 *last = d == 0 ? NULL : last_rd + (j - base) * words;
+      bitapRow(row, row + words, last, charMatch, words);
+      if ((row[matchword] & matchmask) != 0) {
         double score = match_bitapScore(d, j - 1, loc, pattern);
         // This match will almost certainly be better than any existing
         // match.  But check anyway.
@@ -1540,17 +3508,14 @@ int diff_match_patch::match_bitap(const QString &text, const QString &pattern,
       // No hope for a (better) match at greater error levels.
       break;
     }
-    delete [] last_rd;
-    last_rd = rd;
+    std::swap(rd, last_rd);
   }
-  delete [] last_rd;
-  delete [] rd;
   return best_loc;
 }
 
 
 double diff_match_patch::match_bitapScore(int e, int x, int loc,
-                                          const QString &pattern) {
+                                          const QString &pattern) const {
   const float accuracy = static_cast<float> (e) / pattern.length();
   const int proximity = qAbs(loc - x);
   if (Match_Distance == 0) {
@@ -1561,7 +3526,7 @@ double diff_match_patch::match_bitapScore(int e, int x, int loc,
 }
 
 
-QMap<QChar, int> diff_match_patch::match_alphabet(const QString &pattern) {
+QMap<QChar, int> diff_match_patch::match_alphabet(const QString &pattern) const {
   QMap<QChar, int> s;
   int i;
   for (i = 0; i < pattern.length(); i++) {
@@ -1579,33 +3544,172 @@ QMap<QChar, int> diff_match_patch::match_alphabet(const QString &pattern) {
 //  PATCH FUNCTIONS
 
 
-void diff_match_patch::patch_addContext(Patch &patch, const QString &text) {
-  if (text.isEmpty()) {
+/**
+ * A text made of the start of one string and the rest of another, read in
+ * place rather than joined into a new string.  Either string may come with a
+ * PreparedText index to answer the uniqueness check without scanning.
+ */
+class SplitText {
+ public:
+  SplitText(const QString &_patched, int _head, const QString &_original,
+            int _tail, const PreparedText *_patchedIndex,
+            const PreparedText *_originalIndex) :
+    patched(_patched), head(_head), original(_original), tail(_tail),
+    patchedIndex(_patchedIndex), originalIndex(_originalIndex) {
+  }
+
+  int length() const {
+    return head + original.length() - tail;
+  }
+
+  /**
+   * Same as safeMid(text, pos, len) on the joined text.
+   * @param pos Start of the substring.
+   * @param len Length of the substring.
+   * @return The substring.
+   */
+  QString mid(int pos, int len) const {
+    const int end = std::min(length(), pos + len);
+    pos = std::min(pos, end);
+    QString result;
+    result.reserve(end - pos);
+    if (pos < head) {
+      result += patched.mid(pos, std::min(end, head) - pos);
+    }
+    if (end > head) {
+      const int from = std::max(pos, head);
+      result += original.mid(tail + from - head, end - from);
+    }
+    return result;
+  }
+
+  /**
+   * Same as indexOf(pattern) != lastIndexOf(pattern) on the joined text.
+   * @param pattern The text to find.
+   * @return True if the pattern occurs more than once.
+   */
+  bool repeats(const QString &pattern) const {
+    const int m = pattern.length();
+    if (m == 0) {
+      // Found at the first and the last character.
+      return length() != 1;
+    }
+    int count = 0;
+    // Wholly within the first piece.
+    int i = find(patched, patchedIndex, pattern, 0, head);
+    while (i != -1 && ++count < 2) {
+      i = find(patched, patchedIndex, pattern, i + 1, head);
+    }
+    // Across the join.
+    const int start = std::max(0, head - m + 1);
+    const QString join = mid(start, std::min(length(), head + m - 1) - start);
+    i = TextSearch::indexOf(join, pattern);
+    while (count < 2 && i != -1 && start + i < head) {
+      count++;
+      i = TextSearch::indexOf(join, pattern, i + 1);
+    }
+    // Wholly within the second piece.
+    i = find(original, originalIndex, pattern, tail, original.length());
+    while (count < 2 && i != -1) {
+      count++;
+      i = find(original, originalIndex, pattern, i + 1, original.length());
+    }
+    return count >= 2;
+  }
+
+  /**
+   * Answer the uniqueness check from indexes from now on.
+   * @param _patchedIndex Index of the first text.
+   * @param _originalIndex Index of the second text.
+   */
+  void setIndexes(const PreparedText *_patchedIndex,
+                  const PreparedText *_originalIndex) {
+    patchedIndex = _patchedIndex;
+    originalIndex = _originalIndex;
+  }
+
+ private:
+  /**
+   * Find the first occurrence of a pattern lying wholly within part of a
+   * text.
+   * @param text The text to search.
+   * @param index Index of the text, or NULL to scan.
+   * @param pattern The text to find, not empty.
+   * @param begin Start of the part.
+   * @param end End of the part.
+   * @return Index of the occurrence, or -1.
+   */
+  static int find(const QString &text, const PreparedText *index,
+                  const QString &pattern, int begin, int end) {
+    if (begin > end) {
+      return -1;
+    }
+    if (index != NULL) {
+      const int i = index->indexOf(pattern, begin);
+      return i != -1 && i + pattern.length() <= end ? i : -1;
+    }
+    return TextSearch::indexOf(text.unicode(), end, pattern.unicode(),
+                               pattern.length(), begin);
+  }
+
+  const QString &patched;
+  const int head;
+  const QString &original;
+  const int tail;
+  const PreparedText *patchedIndex;
+  const PreparedText *originalIndex;
+};
+
+
+void diff_match_patch::patch_addContext(Patch &patch, const QString &text) const {
+  patch_addContext(patch, text, text.length(), text, text.length(), NULL);
+}
+
+
+void diff_match_patch::patch_addContext(Patch &patch, const QString &patched,
+                                        int head, const QString &original,
+                                        int tail,
+                                        QList<PreparedText> *indexes) const {
+  const bool indexed = indexes != NULL && !indexes->isEmpty();
+  SplitText text(patched, head, original, tail,
+                 indexed ? &indexes->at(0) : NULL,
+                 indexed ? &indexes->at(1) : NULL);
+  if (text.length() == 0) {
     return;
   }
-  QString pattern = safeMid(text, patch.start2, patch.length1);
+  QString pattern = text.mid(patch.start2, patch.length1);
   int padding = 0;
 
   // Look for the first and last matches of pattern in text.  If two different
   // matches are found, increase the pattern length.
-  while (text.indexOf(pattern) != text.lastIndexOf(pattern)
-      && pattern.length() < Match_MaxBits - Patch_Margin - Patch_Margin) {
+  bool repeats = text.repeats(pattern);
+  if (repeats && indexes != NULL && !indexed) {
+    // Most contexts are unique at once and a scan answers that; index the
+    // texts only now that there may be several checks to come.
+    indexes->append(PreparedText(patched));
+    indexes->append(PreparedText(original));
+    text.setIndexes(&indexes->at(0), &indexes->at(1));
+  }
+  while (repeats
+      && (Match_MaxBits == 0
+      || pattern.length() < Match_MaxBits - Patch_Margin - Patch_Margin)) {
     padding += Patch_Margin;
-    pattern = safeMid(text, std::max(0, patch.start2 - padding),
+    pattern = text.mid(std::max(0, patch.start2 - padding),
         std::min(text.length(), patch.start2 + patch.length1 + padding)
         - std::max(0, patch.start2 - padding));
+    repeats = text.repeats(pattern);
   }
   // Add one chunk for good luck.
   padding += Patch_Margin;
 
   // Add the prefix.
-  QString prefix = safeMid(text, std::max(0, patch.start2 - padding),
+  QString prefix = text.mid(std::max(0, patch.start2 - padding),
       patch.start2 - std::max(0, patch.start2 - padding));
   if (!prefix.isEmpty()) {
     patch.diffs.prepend(Diff(EQUAL, prefix));
   }
   // Add the suffix.
-  QString suffix = safeMid(text, patch.start2 + patch.length1,
+  QString suffix = text.mid(patch.start2 + patch.length1,
       std::min(text.length(), patch.start2 + patch.length1 + padding)
       - (patch.start2 + patch.length1));
   if (!suffix.isEmpty()) {
@@ -1622,7 +3726,7 @@ void diff_match_patch::patch_addContext(Patch &patch, const QString &text) {
 
 
 QList<Patch> diff_match_patch::patch_make(const QString &text1,
-                                          const QString &text2) {
+                                          const QString &text2) const {
   // Check for null inputs.
   if (text1.isNull() || text2.isNull()) {
     throw "Null inputs. (patch_make)";
@@ -1639,7 +3743,7 @@ QList<Patch> diff_match_patch::patch_make(const QString &text1,
 }
 
 
-QList<Patch> diff_match_patch::patch_make(const QList<Diff> &diffs) {
+QList<Patch> diff_match_patch::patch_make(const QList<Diff> &diffs) const {
   // No origin string provided, compute our own.
   const QString text1 = diff_text1(diffs);
   return patch_make(text1, diffs);
@@ -1648,7 +3752,7 @@ QList<Patch> diff_match_patch::patch_make(const QList<Diff> &diffs) {
 
 QList<Patch> diff_match_patch::patch_make(const QString &text1,
                                           const QString &text2,
-                                          const QList<Diff> &diffs) {
+                                          const QList<Diff> &diffs) const {
   // text2 is entirely unused.
   return patch_make(text1, diffs);
 
@@ -1657,7 +3761,7 @@ QList<Patch> diff_match_patch::patch_make(const QString &text1,
 
 
 QList<Patch> diff_match_patch::patch_make(const QString &text1,
-                                          const QList<Diff> &diffs) {
+                                          const QList<Diff> &diffs) const {
   // Check for null inputs.
   if (text1.isNull()) {
     throw "Null inputs. (patch_make)";
@@ -1672,10 +3776,19 @@ QList<Patch> diff_match_patch::patch_make(const QString &text1,
   int char_count2 = 0;  // Number of characters into the text2 string.
   // Start with text1 (prepatch_text) and apply the diffs until we arrive at
   // text2 (postpatch_text).  We recreate the patches one by one to determine
-  // context info.
-  QString prepatch_text = text1;
-  QString postpatch_text = text1;
-  foreach(Diff aDiff, diffs) {
+  // context info.  Rather than editing copies of the text, the prepatch text
+  // is described as the first prepatch_head characters of text2 followed by
+  // text1 from prepatch_tail onwards.
+  const QString text2 = diff_text2(diffs);
+  // Occurrence indexes of text2 and text1 for the uniqueness checks, built
+  // by the first context that needs to grow rather than scanning the whole
+  // text each time one does.
+  QList<PreparedText> indexes;
+  int prepatch_head = 0;
+  int prepatch_tail = 0;
+  int text1_count = 0;  // Number of characters into text1 itself.
+  for (int x = 0; x < diffs.size(); x++) {
+    const Diff &aDiff = diffs[x];
     if (patch.diffs.isEmpty() && aDiff.operation != EQUAL) {
       // A new patch starts here.
       patch.start1 = char_count1;
@@ -1686,18 +3799,14 @@ QList<Patch> diff_match_patch::patch_make(const QString &text1,
       case INSERT:
         patch.diffs.append(aDiff);
         patch.length2 += aDiff.text.length();
-        postpatch_text = postpatch_text.left(char_count2)
-            + aDiff.text + safeMid(postpatch_text, char_count2);
         break;
       case DELETE:
         patch.length1 += aDiff.text.length();
         patch.diffs.append(aDiff);
-        postpatch_text = postpatch_text.left(char_count2)
-            + safeMid(postpatch_text, char_count2 + aDiff.text.length());
         break;
       case EQUAL:
         if (aDiff.text.length() <= 2 * Patch_Margin
-            && !patch.diffs.isEmpty() && !(aDiff == diffs.back())) {
+            && !patch.diffs.isEmpty() && x != diffs.size() - 1) {
           // Small equality inside a patch.
           patch.diffs.append(aDiff);
           patch.length1 += aDiff.text.length();
@@ -1707,14 +3816,16 @@ QList<Patch> diff_match_patch::patch_make(const QString &text1,
         if (aDiff.text.length() >= 2 * Patch_Margin) {
           // Time for a new patch.
           if (!patch.diffs.isEmpty()) {
-            patch_addContext(patch, prepatch_text);
+            patch_addContext(patch, text2, prepatch_head, text1,
+                             prepatch_tail, &indexes);
             patches.append(patch);
             patch = Patch();
             // Unlike Unidiff, our patch lists have a rolling context.
             // http://code.google.com/p/google-diff-match-patch/wiki/Unidiff
             // Update prepatch text & pos to reflect the application of the
             // just completed patch.
-            prepatch_text = postpatch_text;
+            prepatch_head = char_count2;
+            prepatch_tail = text1_count;
             char_count1 = char_count2;
           }
         }
@@ -1724,6 +3835,7 @@ QList<Patch> diff_match_patch::patch_make(const QString &text1,
     // Update the current character count.
     if (aDiff.operation != INSERT) {
       char_count1 += aDiff.text.length();
+      text1_count += aDiff.text.length();
     }
     if (aDiff.operation != DELETE) {
       char_count2 += aDiff.text.length();
@@ -1731,7 +3843,8 @@ QList<Patch> diff_match_patch::patch_make(const QString &text1,
   }
   // Pick up the leftover patch if not empty.
   if (!patch.diffs.isEmpty()) {
-    patch_addContext(patch, prepatch_text);
+    patch_addContext(patch, text2, prepatch_head, text1, prepatch_tail,
+                     &indexes);
     patches.append(patch);
   }
 
@@ -1739,7 +3852,7 @@ QList<Patch> diff_match_patch::patch_make(const QString &text1,
 }
 
 
-QList<Patch> diff_match_patch::patch_deepCopy(QList<Patch> &patches) {
+QList<Patch> diff_match_patch::patch_deepCopy(const QList<Patch> &patches) const {
   QList<Patch> patchesCopy;
   foreach(Patch aPatch, patches) {
     Patch patchCopy = Patch();
@@ -1757,46 +3870,115 @@ QList<Patch> diff_match_patch::patch_deepCopy(QList<Patch> &patches) {
 }
 
 
+/**
+ * Same as safeMid() on the text of a buffer.
+ * @param buffer Text being patched.
+ * @param pos Start of the substring.
+ * @param len Length of the substring.
+ * @return The substring.
+ */
+static QString bufferMid(const TextBuffer &buffer, int pos, int len) {
+  return (pos == buffer.length()) ? QString("") : buffer.mid(pos, len);
+}
+
+
+/**
+ * Replace the text between two positions, as patch_apply() once did with
+ * text.left(start) + replacement + safeMid(text, end): positions past the
+ * end of the text stop at the end.
+ * @param buffer Text being patched.
+ * @param start Start of the text to replace.
+ * @param end End of the text to replace, at least start.
+ * @param replacement Text to put there.
+ */
+static void replace(TextBuffer &buffer, int start, int end,
+                    const QString &replacement) {
+  start = std::min(start, buffer.length());
+  end = std::min(end, buffer.length());
+  buffer.replace(start, end - start, replacement);
+}
+
+
 QPair<QString, QVector<bool> > diff_match_patch::patch_apply(
-    QList<Patch> &patches, const QString &sourceText) {
-  QString text = sourceText;  // Copy to preserve original.
+    const QList<Patch> &patches, const QString &sourceText) const {
+  return patch_apply(patch_compile(patches), sourceText);
+}
+
+
+CompiledPatchSet diff_match_patch::patch_compile(
+    const QList<Patch> &patches) const {
+  CompiledPatchSet compiled;
   if (patches.isEmpty()) {
-    return QPair<QString,QVector<bool> >(text, QVector<bool>(0));
+    return compiled;
   }
 
   // Deep copy the patches so that no changes are made to originals.
-  QList<Patch> patchesCopy = patch_deepCopy(patches);
+  compiled.patches = patch_deepCopy(patches);
+  compiled.padding = patch_addPadding(compiled.patches);
+  patch_splitMax(compiled.patches);
+  compiled.maxBits = Match_MaxBits;
+
+  foreach(const Patch &aPatch, compiled.patches) {
+    const QString text1 = diff_text1(aPatch.diffs);
+    compiled.texts1.append(text1);
+    compiled.texts2.append(diff_text2(aPatch.diffs));
+    if (Match_MaxBits != 0 && text1.length() > Match_MaxBits) {
+      // patch_splitMax will only provide an oversized pattern in the case of
+      // a monster delete.
+      compiled.heads.append(MatchAlphabet(text1.left(Match_MaxBits)));
+      compiled.tailIndex.append(compiled.tails.size());
+      compiled.tails.append(MatchAlphabet(text1.right(Match_MaxBits)));
+    } else {
+      compiled.heads.append(MatchAlphabet(text1));
+      compiled.tailIndex.append(-1);
+    }
+  }
+  return compiled;
+}
+
+
+QPair<QString, QVector<bool> > diff_match_patch::patch_apply(
+    const CompiledPatchSet &compiled, const QString &sourceText) const {
+  QString text = sourceText;  // Copy to preserve original.
+  if (compiled.patches.isEmpty()) {
+    return QPair<QString,QVector<bool> >(text, QVector<bool>(0));
+  }
 
-  QString nullPadding = patch_addPadding(patchesCopy);
-  text = nullPadding + text + nullPadding;
-  patch_splitMax(patchesCopy);
+  const QString &nullPadding = compiled.padding;
+  const int maxBits = compiled.maxBits;
+  // Edit the padded text in place and build the result once at the end.
+  TextBuffer buffer(nullPadding + text + nullPadding);
 
-  int x = 0;
   // delta keeps track of the offset between the expected and actual location
   // of the previous patch.  If there are patches expected at positions 10 and
   // 20, but the first patch was found at 12, delta is 2 and the second patch
   // has an effective expected position of 22.
   int delta = 0;
-  QVector<bool> results(patchesCopy.size());
-  foreach(Patch aPatch, patchesCopy) {
+  QVector<bool> results(compiled.patches.size());
+  QVector<quint64> rows;  // Bitap scratch space shared by every match.
+  for (int x = 0; x < compiled.patches.size(); x++) {
+    const Patch &aPatch = compiled.patches[x];
     int expected_loc = aPatch.start2 + delta;
-    QString text1 = diff_text1(aPatch.diffs);
+    const QString &text1 = compiled.texts1[x];
     int start_loc;
     int end_loc = -1;
-    if (text1.length() > Match_MaxBits) {
+    if (compiled.tailIndex[x] != -1) {
       // patch_splitMax will only provide an oversized pattern in the case of
       // a monster delete.
-      start_loc = match_main(text, text1.left(Match_MaxBits), expected_loc);
+      start_loc = match_main(buffer, text1.left(maxBits), compiled.heads[x],
+          expected_loc, maxBits, rows);
       if (start_loc != -1) {
-        end_loc = match_main(text, text1.right(Match_MaxBits),
-            expected_loc + text1.length() - Match_MaxBits);
+        end_loc = match_main(buffer, text1.right(maxBits),
+            compiled.tails[compiled.tailIndex[x]],
+            expected_loc + text1.length() - maxBits, maxBits, rows);
         if (end_loc == -1 || start_loc >= end_loc) {
           // Can't find valid trailing context.  Drop this patch.
           start_loc = -1;
         }
       }
     } else {
-      start_loc = match_main(text, text1, expected_loc);
+      start_loc = match_main(buffer, text1, compiled.heads[x], expected_loc,
+          maxBits, rows);
     }
     if (start_loc == -1) {
       // No match found.  :(
@@ -1809,38 +3991,39 @@ QPair<QString, QVector<bool> > diff_match_patch::patch_apply(
       delta = start_loc - expected_loc;
       QString text2;
       if (end_loc == -1) {
-        text2 = safeMid(text, start_loc, text1.length());
+        text2 = bufferMid(buffer, start_loc, text1.length());
       } else {
-        text2 = safeMid(text, start_loc, end_loc + Match_MaxBits - start_loc);
+        text2 = bufferMid(buffer, start_loc,
+            end_loc + maxBits - start_loc);
       }
       if (text1 == text2) {
         // Perfect match, just shove the replacement text in.
-        text = text.left(start_loc) + diff_text2(aPatch.diffs)
-            + safeMid(text, start_loc + text1.length());
+        replace(buffer, start_loc, start_loc + text1.length(),
+            compiled.texts2[x]);
       } else {
         // Imperfect match.  Run a diff to get a framework of equivalent
         // indices.
         QList<Diff> diffs = diff_main(text1, text2, false);
-        if (text1.length() > Match_MaxBits
+        if (end_loc != -1
             && diff_levenshtein(diffs) / static_cast<float> (text1.length())
             > Patch_DeleteThreshold) {
           // The end points match, but the content is unacceptably bad.
           results[x] = false;
         } else {
           diff_cleanupSemanticLossless(diffs);
+          const LocationIndex locations(diffs);
           int index1 = 0;
           foreach(Diff aDiff, aPatch.diffs) {
             if (aDiff.operation != EQUAL) {
-              int index2 = diff_xIndex(diffs, index1);
+              int index2 = locations.xIndex(index1);
               if (aDiff.operation == INSERT) {
                 // Insertion
-                text = text.left(start_loc + index2) + aDiff.text
-                    + safeMid(text, start_loc + index2);
+                replace(buffer, start_loc + index2, start_loc + index2,
+                    aDiff.text);
               } else if (aDiff.operation == DELETE) {
                 // Deletion
-                text = text.left(start_loc + index2)
-                    + safeMid(text, start_loc + diff_xIndex(diffs,
-                    index1 + aDiff.text.length()));
+                replace(buffer, start_loc + index2, start_loc
+                    + locations.xIndex(index1 + aDiff.text.length()), "");
               }
             }
             if (aDiff.operation != DELETE) {
@@ -1850,16 +4033,152 @@ QPair<QString, QVector<bool> > diff_match_patch::patch_apply(
         }
       }
     }
-    x++;
   }
   // Strip the padding off.
-  text = safeMid(text, nullPadding.length(), text.length()
+  text = bufferMid(buffer, nullPadding.length(), buffer.length()
       - 2 * nullPadding.length());
   return QPair<QString, QVector<bool> >(text, results);
 }
 
 
-QString diff_match_patch::patch_addPadding(QList<Patch> &patches) {
+/**
+ * A batch of texts to patch, shared by the calling thread and the pool
+ * threads helping it.  Each thread claims the next unclaimed text until
+ * none are left, so the caller finishes the batch even if no pool thread
+ * is free to help.
+ */
+class PatchApplyBatch {
+ public:
+  // What, if anything, applying to one text threw.
+  enum Failure { NONE, CHARS, STRING, BAD_ALLOC, OTHER };
+
+  /**
+   * Constructor.
+   * @param _dmp Settings and methods to apply with.
+   * @param _patches Compiled patch set.
+   * @param _texts Texts to patch.
+   */
+  PatchApplyBatch(const diff_match_patch &_dmp,
+                  const CompiledPatchSet &_patches, const QStringList &_texts) :
+    dmp(_dmp), patches(_patches), texts(_texts), results(_texts.size()),
+    failures(_texts.size(), NONE), messages(_texts.size(), NULL),
+    strings(_texts.size()), next(0) {
+  }
+
+  /**
+   * Patch texts until every one has been claimed.
+   */
+  void work() {
+    int x;
+    while ((x = next.fetchAndAddOrdered(1)) < texts.size()) {
+      if (texts[x].isNull()) {
+        failures[x] = CHARS;
+        messages[x] = "Null inputs. (patch_apply)";
+        continue;
+      }
+      // Exceptions cannot leave a pool thread; record them for the caller.
+      try {
+        results[x] = dmp.patch_apply(patches, texts[x]);
+      } catch (const char *ex) {
+        failures[x] = CHARS;
+        messages[x] = ex;
+      } catch (const QString &ex) {
+        failures[x] = STRING;
+        strings[x] = ex;
+      } catch (const std::bad_alloc &) {
+        failures[x] = BAD_ALLOC;
+      } catch (...) {
+        failures[x] = OTHER;
+      }
+    }
+  }
+
+  /**
+   * Rethrow the failure of the first text which failed, if any.
+   */
+  void rethrow() const {
+    for (int x = 0; x < failures.size(); x++) {
+      switch (failures[x]) {
+        case NONE:
+          break;
+        case CHARS:
+          throw messages[x];
+        case STRING:
+          throw strings[x];
+        case BAD_ALLOC:
+          throw std::bad_alloc();
+        case OTHER:
+          throw "Unknown exception while patching. (patch_apply)";
+      }
+    }
+  }
+
+  const diff_match_patch &dmp;
+  const CompiledPatchSet &patches;
+  const QStringList &texts;
+  // One slot per text, filled in by whichever thread claims it.
+  QVector<QPair<QString, QVector<bool> > > results;
+  QVector<Failure> failures;
+  QVector<const char *> messages;
+  QVector<QString> strings;
+  // The next text to claim.
+  QAtomicInt next;
+  // Released by each helper once it has run out of texts.
+  QSemaphore done;
+};
+
+
+/**
+ * A pool thread helping with a PatchApplyBatch.
+ */
+class PatchApplyJob : public QRunnable {
+ public:
+  /**
+   * Constructor.
+   * @param _batch The batch to help with.
+   */
+  explicit PatchApplyJob(PatchApplyBatch &_batch) : batch(_batch) {
+  }
+
+  void run() {
+    batch.work();
+    batch.done.release();
+  }
+
+ private:
+  PatchApplyBatch &batch;
+};
+
+
+QList<QPair<QString, QVector<bool> > > diff_match_patch::patch_apply(
+    const CompiledPatchSet &patches, const QStringList &texts,
+    QThreadPool *pool) const {
+  if (pool == NULL) {
+    pool = QThreadPool::globalInstance();
+  }
+  PatchApplyBatch batch(*this, patches, texts);
+  // Only take threads which are free now.  Queued helpers would have to
+  // be waited for, which deadlocks when the caller is itself one of the
+  // pool's threads and the pool is full.
+  int helpers = 0;
+  while (helpers < std::min(pool->maxThreadCount(), texts.size() - 1)) {
+    PatchApplyJob *job = new PatchApplyJob(batch);
+    if (!pool->tryStart(job)) {
+      // Not taken, so still ours.
+      delete job;
+      break;
+    }
+    helpers++;
+  }
+  batch.work();
+  batch.done.acquire(helpers);
+
+  batch.rethrow();
+  return batch.results.toList();
+}
+
+
+QString diff_match_patch::patch_addPadding(QList<Patch> &patches) const {
   short paddingLength = Patch_Margin;
   QString nullPadding = "";
   for (short x = 1; x <= paddingLength; x++) {
@@ -1917,32 +4236,47 @@ QString diff_match_patch::patch_addPadding(QList<Patch> &patches) {
 }
 
 
-void diff_match_patch::patch_splitMax(QList<Patch> &patches) {
+void diff_match_patch::patch_splitMax(QList<Patch> &patches) const {
   short patch_size = Match_MaxBits;
+  if (patch_size == 0) {
+    // No limit on pattern length; nothing to split.
+    return;
+  }
+  bool needed = false;
+  foreach(const Patch &aPatch, patches) {
+    if (aPatch.length1 > patch_size) {
+      needed = true;
+      break;
+    }
+  }
+  if (!needed) {
+    return;
+  }
+  // Build the split list afresh rather than inserting into the middle of
+  // the old one, and walk each big patch with a cursor (the diff index and
+  // the number of characters already taken from it) instead of removing
+  // its diffs from the front.
+  QList<Patch> result;
   QString precontext, postcontext;
   Patch patch;
   int start1, start2;
   bool empty;
   Operation diff_type;
   QString diff_text;
-  QMutableListIterator<Patch> pointer(patches);
-  Patch bigpatch;
-
-  if (pointer.hasNext()) {
-    bigpatch = pointer.next();
-  }
+  int pointer, offset;
 
-  while (!bigpatch.isNull()) {
+  foreach(const Patch &bigpatch, patches) {
     if (bigpatch.length1 <= patch_size) {
-      bigpatch = pointer.hasNext() ? pointer.next() : Patch();
+      result.append(bigpatch);
       continue;
     }
-    // Remove the big old patch.
-    pointer.remove();
+    const QList<Diff> &bigdiffs = bigpatch.diffs;
     start1 = bigpatch.start1;
     start2 = bigpatch.start2;
     precontext = "";
-    while (!bigpatch.diffs.isEmpty()) {
+    pointer = 0;
+    offset = 0;
+    while (pointer < bigdiffs.size()) {
       // Create one of several smaller patches.
       patch = Patch();
       empty = true;
@@ -1952,30 +4286,38 @@ void diff_match_patch::patch_splitMax(QList<Patch> &patches) {
         patch.length1 = patch.length2 = precontext.length();
         patch.diffs.append(Diff(EQUAL, precontext));
       }
-      while (!bigpatch.diffs.isEmpty()
+      while (pointer < bigdiffs.size()
           && patch.length1 < patch_size - Patch_Margin) {
-        diff_type = bigpatch.diffs.front().operation;
-        diff_text = bigpatch.diffs.front().text;
+        diff_type = bigdiffs[pointer].operation;
+        const QString &whole = bigdiffs[pointer].text;
+        const int remaining = whole.length() - offset;
         if (diff_type == INSERT) {
           // Insertions are harmless.
+          diff_text = whole;
           patch.length2 += diff_text.length();
           start2 += diff_text.length();
-          patch.diffs.append(bigpatch.diffs.front());
-          bigpatch.diffs.removeFirst();
+          patch.diffs.append(Diff(diff_type, diff_text));
+          pointer++;
+          offset = 0;
           empty = false;
         } else if (diff_type == DELETE && patch.diffs.size() == 1
             && patch.diffs.front().operation == EQUAL
-            && diff_text.length() > 2 * patch_size) {
+            && remaining > 2 * patch_size) {
           // This is a large deletion.  Let it pass in one chunk.
+          diff_text = offset == 0 ? whole : safeMid(whole, offset);
           patch.length1 += diff_text.length();
           start1 += diff_text.length();
           empty = false;
           patch.diffs.append(Diff(diff_type, diff_text));
-          bigpatch.diffs.removeFirst();
+          pointer++;
+          offset = 0;
         } else {
-          // Deletion or equality.  Only take as much as we can stomach.
-          diff_text = diff_text.left(std::min(diff_text.length(),
-              patch_size - patch.length1 - Patch_Margin));
+          // Deletion or equality.  Only take as much as we can stomach,
+          // copying just that much.
+          const int take = std::min(remaining,
+              patch_size - patch.length1 - Patch_Margin);
+          diff_text = offset == 0 && take == remaining ? whole
+              : whole.mid(offset, take);
           patch.length1 += diff_text.length();
           start1 += diff_text.length();
           if (diff_type == EQUAL) {
@@ -1985,22 +4327,41 @@ void diff_match_patch::patch_splitMax(QList<Patch> &patches) {
             empty = false;
           }
           patch.diffs.append(Diff(diff_type, diff_text));
-          if (diff_text == bigpatch.diffs.front().text) {
-            bigpatch.diffs.removeFirst();
+          if (diff_text.length() == remaining) {
+            pointer++;
+            offset = 0;
           } else {
-            bigpatch.diffs.front().text = safeMid(bigpatch.diffs.front().text,
-                diff_text.length());
+            offset += diff_text.length();
           }
         }
       }
-      // Compute the head context for the next patch.
-      precontext = diff_text2(patch.diffs);
+      // Compute the head context for the next patch: the tail of this
+      // patch's text2, gathered from its last diffs.
+      int from = patch.diffs.size();
+      int gathered = 0;
+      while (from > 0 && gathered < Patch_Margin) {
+        from--;
+        if (patch.diffs[from].operation != DELETE) {
+          gathered += patch.diffs[from].text.length();
+        }
+      }
+      precontext = "";
+      for (int x = from; x < patch.diffs.size(); x++) {
+        if (patch.diffs[x].operation != DELETE) {
+          precontext += patch.diffs[x].text;
+        }
+      }
       precontext = safeMid(precontext, precontext.length() - Patch_Margin);
-      // Append the end context for this patch.
-      if (diff_text1(bigpatch.diffs).length() > Patch_Margin) {
-        postcontext = diff_text1(bigpatch.diffs).left(Patch_Margin);
-      } else {
-        postcontext = diff_text1(bigpatch.diffs);
+      // Append the end context for this patch: the head of the remaining
+      // text1, gathered from the diffs after the cursor.
+      postcontext = "";
+      for (int x = pointer, skip = offset;
+          x < bigdiffs.size() && postcontext.length() < Patch_Margin;
+          x++, skip = 0) {
+        if (bigdiffs[x].operation != INSERT) {
+          postcontext += bigdiffs[x].text.mid(skip,
+              Patch_Margin - postcontext.length());
+        }
       }
       if (!postcontext.isEmpty()) {
         patch.length1 += postcontext.length();
@@ -2013,93 +4374,265 @@ void diff_match_patch::patch_splitMax(QList<Patch> &patches) {
         }
       }
       if (!empty) {
-        pointer.insert(patch);
+        result.append(patch);
       }
     }
-    bigpatch = pointer.hasNext() ? pointer.next() : Patch();
   }
+  patches = result;
 }
 
 
-QString diff_match_patch::patch_toText(const QList<Patch> &patches) {
+QString diff_match_patch::patch_toText(const QList<Patch> &patches) const {
+  int length = 0;
+  foreach(const Patch &aPatch, patches) {
+    length += patchTextLength(aPatch);
+  }
   QString text;
-  foreach(Patch aPatch, patches) {
-    text.append(aPatch.toString());
+  text.reserve(length);
+  foreach(const Patch &aPatch, patches) {
+    appendPatchText(text, aPatch);
   }
   return text;
 }
 
 
-QList<Patch> diff_match_patch::patch_fromText(const QString &textline) {
+bool diff_match_patch::patch_toText(const QList<Patch> &patches,
+                                    QIODevice *device) const {
+  WriteState state;
+  state.device = device;
+  state.ok = true;
+  patch_toText(patches, writeToDevice, &state);
+  return state.ok;
+}
+
+
+void diff_match_patch::patch_toText(const QList<Patch> &patches,
+                                    TextSink sink, void *context) const {
+  QString chunk;
+  chunk.reserve(SINK_CHUNK);
+  foreach(const Patch &aPatch, patches) {
+    appendPatchHeader(chunk, aPatch);
+    if (chunk.length() >= SINK_CHUNK) {
+      sink(chunk, context);
+      chunk.resize(0);
+    }
+    foreach(const Diff &aDiff, aPatch.diffs) {
+      chunk.append(patchLineSign(aDiff.operation));
+      const QChar *chars = aDiff.text.unicode();
+      const int length = aDiff.text.length();
+      int pointer = 0;
+      while (pointer < length) {
+        // Encode a run at a time, keeping surrogate pairs whole since they
+        // encode as one UTF-8 sequence.
+        int end = std::min(length, pointer + PERCENT_RUN);
+        if (end < length && chars[end - 1].isHighSurrogate()) {
+          end++;
+        }
+        appendPercentEncoded(chunk, chars + pointer, end - pointer);
+        pointer = end;
+        if (chunk.length() >= SINK_CHUNK) {
+          sink(chunk, context);
+          chunk.resize(0);
+        }
+      }
+      chunk.append('\n');
+      if (chunk.length() >= SINK_CHUNK) {
+        sink(chunk, context);
+        chunk.resize(0);
+      }
+    }
+  }
+  if (!chunk.isEmpty()) {
+    sink(chunk, context);
+  }
+}
+
+
+QList<Patch> diff_match_patch::patch_fromText(const QString &textline) const {
   QList<Patch> patches;
-  if (textline.isEmpty()) {
-    return patches;
+  PatchReader reader(textline);
+  while (reader.hasNext()) {
+    patches.append(reader.next());
   }
-  QStringList text = textline.split("\n", QString::SkipEmptyParts);
-  Patch patch;
-  QRegExp patchHeader("^@@ -(\\d+),?(\\d*) \\+(\\d+),?(\\d*) @@$");
-  char sign;
-  QString line;
-  while (!text.isEmpty()) {
-    if (!patchHeader.exactMatch(text.front())) {
-      throw QString("Invalid patch string: %1").arg(text.front());
-    }
-
-    patch = Patch();
-    patch.start1 = patchHeader.cap(1).toInt();
-    if (patchHeader.cap(2).isEmpty()) {
-      patch.start1--;
-      patch.length1 = 1;
-    } else if (patchHeader.cap(2) == "0") {
-      patch.length1 = 0;
-    } else {
-      patch.start1--;
-      patch.length1 = patchHeader.cap(2).toInt();
-    }
+  return patches;
+}
 
-    patch.start2 = patchHeader.cap(3).toInt();
-    if (patchHeader.cap(4).isEmpty()) {
-      patch.start2--;
-      patch.length2 = 1;
-    } else if (patchHeader.cap(4) == "0") {
-      patch.length2 = 0;
-    } else {
-      patch.start2--;
-      patch.length2 = patchHeader.cap(4).toInt();
-    }
-    text.removeFirst();
 
-    while (!text.isEmpty()) {
-      if (text.front().isEmpty()) {
-        text.removeFirst();
-        continue;
+/////////////////////////////////////////////
+//
+// SimilarityIndex Class
+//
+/////////////////////////////////////////////
+
+
+/**
+ * Finalizer of the SplitMix64 generator; a cheap, well mixed 64-bit hash.
+ * @param x Value to mix.
+ * @return Mixed value.
+ */
+static inline quint64 mix64(quint64 x) {
+  x += Q_UINT64_C(0x9e3779b97f4a7c15);
+  x = (x ^ (x >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+  return x ^ (x >> 31);
+}
+
+
+SimilarityIndex::SimilarityIndex() :
+  qgramLength(4), bands(16), rows(4) {
+  for (int i = 0; i < bands * rows; i++) {
+    seeds.append(mix64(i + 1));
+  }
+}
+
+
+SimilarityIndex::SimilarityIndex(int _qgramLength, int _bands, int _rows) :
+  qgramLength(std::max(1, _qgramLength)), bands(std::max(1, _bands)),
+  rows(std::max(1, _rows)) {
+  for (int i = 0; i < bands * rows; i++) {
+    seeds.append(mix64(i + 1));
+  }
+}
+
+
+int SimilarityIndex::insert(const QString &text) {
+  const int id = size();
+  const QVector<quint32> s = sketch(text);
+  for (int band = 0; band < bands; band++) {
+    buckets[bandKey(s.constData(), band)].append(id);
+  }
+  for (int i = 0; i < s.size(); i++) {
+    sketches.append(s[i]);
+  }
+  return id;
+}
+
+
+int SimilarityIndex::size() const {
+  return sketches.size() / (bands * rows);
+}
+
+
+/**
+ * Order of the results of SimilarityIndex::nearest(): best score first; on a
+ * tie, the more recent document.
+ * @param a One result.
+ * @param b Another result.
+ * @return True if 'a' ranks before 'b'.
+ */
+static bool rankedBefore(const QPair<int, double> &a,
+                         const QPair<int, double> &b) {
+  return a.second > b.second || (a.second == b.second && a.first > b.first);
+}
+
+
+QList<QPair<int, double> > SimilarityIndex::nearest(const QString &text,
+                                                    int count) const {
+  QList<QPair<int, double> > results;
+  const int documents = size();
+  if (count <= 0 || documents == 0) {
+    return results;
+  }
+  const QVector<quint32> s = sketch(text);
+  const int hashes = bands * rows;
+
+  // Gather the documents sharing at least one bucket.
+  QVector<bool> seen(documents, false);
+  QList<int> candidates;
+  for (int band = 0; band < bands; band++) {
+    QHash<quint64, QList<int> >::const_iterator bucket =
+        buckets.constFind(bandKey(s.constData(), band));
+    if (bucket == buckets.constEnd()) {
+      continue;
+    }
+    foreach(int id, bucket.value()) {
+      if (!seen[id]) {
+        seen[id] = true;
+        candidates.append(id);
       }
-      sign = text.front()[0].toAscii();
-      line = safeMid(text.front(), 1);
-      line = line.replace("+", "%2B");  // decode would change all "+" to " "
-      line = QUrl::fromPercentEncoding(qPrintable(line));
-      if (sign == '-') {
-        // Deletion.
-        patch.diffs.append(Diff(DELETE, line));
-      } else if (sign == '+') {
-        // Insertion.
-        patch.diffs.append(Diff(INSERT, line));
-      } else if (sign == ' ') {
-        // Minor equality.
-        patch.diffs.append(Diff(EQUAL, line));
-      } else if (sign == '@') {
-        // Start of next patch.
-        break;
-      } else {
-        // WTF?
-        throw QString("Invalid patch mode '%1' in: %2").arg(sign).arg(line);
-        return QList<Patch>();
+    }
+  }
+  if (candidates.size() < count) {
+    // Too few near neighbours, rank everything.
+    for (int id = 0; id < documents; id++) {
+      if (!seen[id]) {
+        candidates.append(id);
       }
-      text.removeFirst();
     }
+  }
 
-    patches.append(patch);
+  foreach(int id, candidates) {
+    results.append(QPair<int, double>(id,
+        compare(s.constData(), sketches.constData() + id * hashes)));
+  }
+  // Only the best 'count' need to be put in order.
+  const int kept = std::min(count, results.size());
+  std::partial_sort(results.begin(), results.begin() + kept, results.end(),
+                    rankedBefore);
+  return results.mid(0, kept);
+}
+
+
+double SimilarityIndex::similarity(const QString &text1,
+                                   const QString &text2) const {
+  const QVector<quint32> s1 = sketch(text1);
+  const QVector<quint32> s2 = sketch(text2);
+  return compare(s1.constData(), s2.constData());
+}
 
+
+QVector<quint32> SimilarityIndex::sketch(const QString &text) const {
+  const int hashes = bands * rows;
+  QVector<quint32> s(hashes, 0xffffffffu);
+  if (text.isEmpty()) {
+    return s;
   }
-  return patches;
+  // A text shorter than one q-gram is a single q-gram.
+  const int q = std::min(qgramLength, text.length());
+  const QChar *chars = text.unicode();
+  // Polynomial rolling hash of the current q-gram.
+  const quint64 base = Q_UINT64_C(1099511628211);
+  quint64 power = 1;  // base^(q-1), to remove the outgoing character.
+  quint64 gram = 0;
+  for (int i = 0; i < q; i++) {
+    gram = gram * base + chars[i].unicode();
+    if (i > 0) {
+      power *= base;
+    }
+  }
+  for (int i = q; ; i++) {
+    for (int h = 0; h < hashes; h++) {
+      const quint32 value = static_cast<quint32>(mix64(gram ^ seeds[h]) >> 32);
+      if (value < s[h]) {
+        s[h] = value;
+      }
+    }
+    if (i == text.length()) {
+      break;
+    }
+    gram = (gram - chars[i - q].unicode() * power) * base + chars[i].unicode();
+  }
+  return s;
+}
+
+
+quint64 SimilarityIndex::bandKey(const quint32 *sketch, int band) const {
+  quint64 key = mix64(band);
+  for (int r = 0; r < rows; r++) {
+    key = mix64(key ^ sketch[band * rows + r]);
+  }
+  return key;
+}
+
+
+double SimilarityIndex::compare(const quint32 *sketch1,
+                                const quint32 *sketch2) const {
+  const int hashes = bands * rows;
+  int same = 0;
+  for (int h = 0; h < hashes; h++) {
+    if (sketch1[h] == sketch2[h]) {
+      same++;
+    }
+  }
+  return same / static_cast<double>(hashes);
 }
@@ -30,6 +30,12 @@
  *
  * Code known to compile and run with Qt 4.3 through Qt 4.7.
  *
+ * All methods are const and the library keeps no static mutable state, so a
+ * configured instance may be shared by any number of threads without locking.
+ * Set the options once, then hand out a const reference (or a copy, which is
+ * an independent snapshot of the options).  Writing to the option fields while
+ * another thread is using the same instance is not safe.
+ *
  * Here is a trivial sample program which works properly when linked with this
  * library:
  *
@@ -110,7 +116,421 @@ class Patch {
    */
   Patch();
   bool isNull() const;
-  QString toString();
+  QString toString() const;
+};
+
+
+/**
+ * Precomputed map from text1 locations to text2 locations for one diff list.
+ * Gives the same answers as diff_match_patch::diff_xIndex(), but by binary
+ * search over the cumulative offsets instead of a walk from the start, and
+ * maps an ascending batch of locations in one sweep.
+ */
+class LocationIndex {
+ public:
+  /**
+   * Constructor.  Indexes a diff list; the list is not referenced afterwards.
+   * @param diffs LinkedList of Diff objects.
+   */
+  explicit LocationIndex(const QList<Diff> &diffs);
+
+  /**
+   * loc is a location in text1, compute and return the equivalent location in
+   * text2.
+   * @param loc Location within text1.
+   * @return Location within text2.
+   */
+  int xIndex(int loc) const;
+
+  /**
+   * Translate many text1 locations at once.  Ascending locations are mapped
+   * in a single sweep; any out of order fall back to a binary search.
+   * @param locs Locations within text1.
+   * @return Locations within text2, in the same order.
+   */
+  QVector<int> xIndex(const QVector<int> &locs) const;
+
+ private:
+  /**
+   * Find the diff containing a text1 location.
+   * @param loc Location within text1.
+   * @return Index of the first diff ending after loc, or the number of diffs.
+   */
+  int segment(int loc) const;
+
+  /**
+   * Translate a location within a known diff.
+   * @param segment Index returned by segment().
+   * @param loc Location within text1.
+   * @return Location within text2.
+   */
+  int translate(int segment, int loc) const;
+
+  // Offsets in text1 and text2 at which each diff starts, then the lengths.
+  QVector<int> starts1;
+  QVector<int> starts2;
+  // Which diffs are deletions.
+  QVector<bool> deletions;
+};
+
+
+/**
+ * An editable text kept as a gap buffer: the characters sit in one array
+ * with a gap at the last edit point, so edits near each other cost only the
+ * distance between them.  patch_apply() edits the document in place this
+ * way and builds the finished string once.
+ */
+class TextBuffer {
+ public:
+  /**
+   * Constructor.  Starts with a copy of a text.
+   * @param text Initial contents.
+   */
+  explicit TextBuffer(const QString &text);
+
+  /**
+   * Number of characters in the text.
+   * @return Text length.
+   */
+  int length() const {
+    return buffer.length() - (gapEnd - gapStart);
+  }
+
+  /**
+   * Same as mid(pos, len) on the text as a QString.
+   * @param pos Start of the substring.
+   * @param len Length of the substring; negative for the rest of the text.
+   * @return The substring; null if pos is past the end.
+   */
+  QString mid(int pos, int len) const;
+
+  /**
+   * Replace part of the text.
+   * @param pos Start of the part, at most length().
+   * @param len Length of the part, at most length() - pos.
+   * @param text Replacement text.
+   */
+  void replace(int pos, int len, const QString &text);
+
+  /**
+   * Make the start of the text contiguous.
+   * @param end Number of characters needed, at most length().
+   * @return Pointer to the first 'end' characters, valid until the next
+   *     edit.
+   */
+  const QChar *prefix(int end);
+
+ private:
+  /**
+   * Move the gap to a text position.
+   * @param pos New start of the gap.
+   */
+  void moveGap(int pos);
+
+  QString buffer;
+  int gapStart;
+  int gapEnd;
+};
+
+
+/**
+ * Bitap alphabet of one pattern: for each character, the bit mask of the
+ * pattern positions holding it (the last character is bit 0).  Masks span
+ * as many 64-bit words as the pattern needs, least significant word first.
+ * Characters below 256 are looked up in a flat table; the rest in a short
+ * sorted array, so no lookup allocates or walks a tree.
+ */
+class MatchAlphabet {
+ public:
+  /**
+   * Constructor.  Builds the alphabet of a pattern.
+   * @param pattern The text to encode.
+   */
+  explicit MatchAlphabet(const QString &pattern);
+
+  /**
+   * Number of 64-bit words in each mask.
+   * @return Word count, at least 1.
+   */
+  int words() const {
+    return wordCount;
+  }
+
+  /**
+   * Bit mask of a character.
+   * @param c Character to look up.
+   * @return words() words of mask; all zero if c is not in the pattern.
+   */
+  const quint64 *mask(QChar c) const {
+    const ushort u = c.unicode();
+    return u < 256 ? latin1.constData() + u * wordCount : otherMask(u);
+  }
+
+  /**
+   * Mask of a character not in the pattern.
+   * @return words() zero words.
+   */
+  const quint64 *noMatch() const {
+    return otherMasks.constData() + others.size() * wordCount;
+  }
+
+ private:
+  /**
+   * Bit mask of a character outside the flat table.
+   * @param c Character to look up.
+   * @return words() words of mask; all zero if c is not in the pattern.
+   */
+  const quint64 *otherMask(ushort c) const;
+
+  int wordCount;
+  // Masks of the characters below 256.
+  QVector<quint64> latin1;
+  // Other characters of the pattern, ascending, and their masks, followed
+  // by one all-zero mask for characters not in the pattern.
+  QVector<ushort> others;
+  QVector<quint64> otherMasks;
+};
+
+
+/**
+ * Substring search on raw UTF-16, shared by the diff, match and patch
+ * methods.  Where SSE2 is available, candidates are found eight positions at
+ * a time by comparing the first and last characters of the pattern; other
+ * builds use a Horspool search.  Results are the same as QString's.
+ */
+class TextSearch {
+ public:
+  /**
+   * Same as text.indexOf(pattern, from).
+   * @param text The text to search.
+   * @param pattern The text to find.
+   * @param from Where to start looking; negative counts from the end.
+   * @return Index of the first occurrence at or after from, or -1.
+   */
+  static int indexOf(const QString &text, const QString &pattern,
+                     int from = 0);
+
+  /**
+   * Same as text.lastIndexOf(pattern, from).
+   * @param text The text to search.
+   * @param pattern The text to find.
+   * @param from Where to start looking back from; negative counts from
+   *     the end.
+   * @return Index of the last occurrence at or before from, or -1.
+   */
+  static int lastIndexOf(const QString &text, const QString &pattern,
+                         int from = -1);
+
+  /**
+   * Find the first occurrence of a pattern in a buffer.
+   * @param text The text to search.
+   * @param textLength Length of text.
+   * @param pattern The text to find.
+   * @param patternLength Length of pattern.
+   * @param from Where to start looking, 0 to textLength.
+   * @return Index of the first occurrence at or after from, or -1.
+   */
+  static int indexOf(const QChar *text, int textLength, const QChar *pattern,
+                     int patternLength, int from);
+
+  /**
+   * Find the last occurrence of a pattern in a buffer.
+   * @param text The text to search.
+   * @param textLength Length of text.
+   * @param pattern The text to find.
+   * @param patternLength Length of pattern, at most textLength.
+   * @param from Last start position to consider, 0 to
+   *     textLength - patternLength.
+   * @return Index of the last occurrence at or before from, or -1.
+   */
+  static int lastIndexOf(const QChar *text, int textLength,
+                         const QChar *pattern, int patternLength, int from);
+};
+
+
+/**
+ * A text prepared for many match_main() searches.
+ * Records where each q-gram (run of up to four characters) occurs, so that
+ * exact matches are found by checking the occurrences of the pattern's rarest
+ * q-gram rather than by scanning the text, and searches which cannot succeed
+ * are rejected without running the bitap.
+ * The text cannot change once prepared.  Lookups are const and may run
+ * concurrently.
+ */
+class PreparedText {
+ public:
+  /**
+   * Constructor.  Indexes a text.
+   * @param text The text to search.
+   * @param qgramLength Number of characters in each q-gram, 1 to 4.
+   */
+  explicit PreparedText(const QString &text, int qgramLength = 4);
+
+  /**
+   * The prepared text.
+   * @return The text given to the constructor.
+   */
+  const QString &text() const {
+    return source;
+  }
+
+  /**
+   * Number of characters in each q-gram.
+   * @return q-gram length, 1 to 4.
+   */
+  int qgram() const {
+    return qgramLength;
+  }
+
+  /**
+   * Same as text().indexOf(pattern, from).
+   * @param pattern The text to find.
+   * @param from Where to start looking.
+   * @return Index of the first occurrence at or after from, or -1.
+   */
+  int indexOf(const QString &pattern, int from) const;
+
+  /**
+   * Same as text().lastIndexOf(pattern, from).
+   * @param pattern The text to find.
+   * @param from Where to start looking back from.
+   * @return Index of the last occurrence at or before from, or -1.
+   */
+  int lastIndexOf(const QString &pattern, int from) const;
+
+  /**
+   * Count the q-grams of a pattern which also start somewhere in part of the
+   * text.  A q-gram found at several places in the pattern counts each time.
+   * @param pattern The pattern to look up.
+   * @param first First text position to consider.
+   * @param last Last text position to consider.
+   * @return Number of pattern positions whose q-gram occurs in the range.
+   */
+  int sharedGrams(const QString &pattern, int first, int last) const;
+
+ private:
+  /**
+   * Pack one q-gram into a key; q-grams of up to four UTF-16 code units
+   * fit exactly.
+   * @param chars Start of the q-gram.
+   * @return Key of the q-gram.
+   */
+  quint64 gramKey(const QChar *chars) const;
+
+  /**
+   * Find the q-gram of a pattern with the fewest occurrences in the text.
+   * @param pattern The pattern, at least qgramLength long.
+   * @param offset Receives the q-gram's position within the pattern.
+   * @return The q-gram's ascending text positions, or NULL if some q-gram
+   *     of the pattern does not occur at all.
+   */
+  const QVector<int> *rarestGram(const QString &pattern, int *offset) const;
+
+  QString source;
+  int qgramLength;
+  // Ascending start positions of each q-gram of the text.
+  QHash<quint64, QVector<int> > grams;
+};
+
+
+/**
+ * A patch list made ready for patch_apply() by diff_match_patch::
+ * patch_compile(): copied, padded and split, with the text each patch
+ * expects and produces and the bitap alphabets of its search patterns
+ * worked out.  Compile once to apply the same patches to many texts.
+ * The set cannot change once compiled, so it may be applied from several
+ * threads at once.
+ */
+class CompiledPatchSet {
+  friend class diff_match_patch;
+
+ public:
+  /**
+   * Constructor.  An empty set, which applies as no patches.
+   */
+  CompiledPatchSet();
+
+  /**
+   * Number of patches after splitting; the length of the results of
+   * applying the set.
+   * @return Patch count.
+   */
+  int size() const {
+    return patches.size();
+  }
+
+ private:
+  // Padded and split patches.
+  QList<Patch> patches;
+  // The padding added to each side of the text.
+  QString padding;
+  // Match_MaxBits the patches were split for.
+  int maxBits;
+  // Text each patch expects, and what it becomes.
+  QStringList texts1;
+  QStringList texts2;
+  // Alphabet of each patch's search pattern: text1, or its first maxBits
+  // characters for a patch too long to search for whole.
+  QList<MatchAlphabet> heads;
+  // For those, the alphabet of the last maxBits characters, and where it
+  // is in 'tails' (-1 for the other patches).
+  QList<MatchAlphabet> tails;
+  QVector<int> tailIndex;
+};
+
+
+/**
+ * Pull parser for the textual form of a patch list, as patch_toText()
+ * writes it.  Reads one line at a time from a device or a string and
+ * hands back one Patch at a time, so that only the patch being read is
+ * held in memory.  Reading every patch gives the same list as
+ * diff_match_patch::patch_fromText().
+ */
+class PatchReader {
+ public:
+  /**
+   * Constructor.  Read UTF-8 text from a device.
+   * @param _device Open, readable device; must outlive the reader.
+   */
+  explicit PatchReader(QIODevice *_device);
+
+  /**
+   * Constructor.  Read from a string.
+   * @param _text Text representation of patches.
+   */
+  explicit PatchReader(const QString &_text);
+
+  /**
+   * Whether there is another patch to read.
+   * @return True if next() will return a patch.
+   */
+  bool hasNext();
+
+  /**
+   * Read the next patch.
+   * @return The patch.
+   * @throws QString If invalid input.
+   */
+  Patch next();
+
+ private:
+  /**
+   * Move on to the next non-empty line.
+   * @return False at the end of the input.
+   */
+  bool readLine();
+
+  // Device being read, or NULL when reading a string.
+  QIODevice *device;
+  // The string being read, or the current line of the device.
+  QString text;
+  // Start of the next line of the string.
+  int pointer;
+  // Span of the current line within 'text'.
+  int lineStart;
+  int lineLength;
+  // Whether the current line has been read but not yet parsed.
+  bool pending;
 };
 
 
@@ -128,6 +548,11 @@ class diff_match_patch {
 
   // Number of seconds to map a diff before giving up (0 for infinity).
   float Diff_Timeout;
+  // Approximate number of bytes of working memory one diff may hold before
+  // it falls back to coarser strategies (0 for infinity).  Over budget, a
+  // character diff is replaced by a line-level diff, and a line-level diff
+  // by a single deletion and insertion.
+  qint64 Diff_MaxMemory;
   // Cost of an empty edit operation in terms of edit characters.
   short Diff_EditCost;
   // At what point is no match declared (0.0 = perfection, 1.0 = very loose).
@@ -144,17 +569,26 @@ class diff_match_patch {
   // Chunk size for context length.
   short Patch_Margin;
 
-  // The number of bits in an int.
+  // The longest pattern matched in one piece, and so the size patches are
+  // split to (0 for no limit).  Bitap handles patterns of any length; the
+  // default of 32 keeps patches identical to those of the other ports.
   short Match_MaxBits;
 
- private:
-  // Define some regex patterns for matching boundaries.
-  static QRegExp BLANKLINEEND;
-  static QRegExp BLANKLINESTART;
-
 
  public:
 
+  /**
+   * Receiver for output written in pieces by the streaming writers.
+   * Called once per chunk, in order.  The chunk is only valid for the call.
+   * @param chunk The next piece of output.
+   * @param context The pointer the caller passed to the writer.
+   */
+  typedef void (*TextSink)(const QString &chunk, void *context);
+
+  // Characters of output gathered before a chunk goes to a TextSink.  Text
+  // is escaped in runs short enough that no chunk reaches twice this.
+  static const int SINK_CHUNK = 8192;
+
   diff_match_patch();
 
   //  DIFF FUNCTIONS
@@ -169,7 +603,7 @@ class diff_match_patch {
    * @param text2 New string to be diffed.
    * @return Linked List of Diff objects.
    */
-  QList<Diff> diff_main(const QString &text1, const QString &text2);
+  QList<Diff> diff_main(const QString &text1, const QString &text2) const;
 
   /**
    * Find the differences between two texts.
@@ -180,7 +614,7 @@ class diff_match_patch {
    *     If true, then run a faster slightly less optimal diff.
    * @return Linked List of Diff objects.
    */
-  QList<Diff> diff_main(const QString &text1, const QString &text2, bool checklines);
+  QList<Diff> diff_main(const QString &text1, const QString &text2, bool checklines) const;
 
   /**
    * Find the differences between two texts.  Simplifies the problem by
@@ -192,10 +626,13 @@ class diff_match_patch {
    *     If true, then run a faster slightly less optimal diff.
    * @param deadline Time when the diff should be complete by.  Used
    *     internally for recursive calls.  Users should set DiffTimeout instead.
+   * @param memory Approximate bytes already held by the callers.  Used
+   *     internally for recursive calls.  Users should set Diff_MaxMemory
+   *     instead.
    * @return Linked List of Diff objects.
    */
  private:
-  QList<Diff> diff_main(const QString &text1, const QString &text2, bool checklines, clock_t deadline);
+  QList<Diff> diff_main(const QString &text1, const QString &text2, bool checklines, clock_t deadline, qint64 memory) const;
 
   /**
    * Find the differences between two texts.  Assumes that the texts do not
@@ -206,10 +643,11 @@ class diff_match_patch {
    *     line-level diff first to identify the changed areas.
    *     If true, then run a faster slightly less optimal diff.
    * @param deadline Time when the diff should be complete by.
+   * @param memory Approximate bytes already held by the callers.
    * @return Linked List of Diff objects.
    */
  private:
-  QList<Diff> diff_compute(QString text1, QString text2, bool checklines, clock_t deadline);
+  QList<Diff> diff_compute(QString text1, QString text2, bool checklines, clock_t deadline, qint64 memory) const;
 
   /**
    * Do a quick line-level diff on both strings, then rediff the parts for
@@ -218,10 +656,11 @@ class diff_match_patch {
    * @param text1 Old string to be diffed.
    * @param text2 New string to be diffed.
    * @param deadline Time when the diff should be complete by.
+   * @param memory Approximate bytes already held by the callers.
    * @return Linked List of Diff objects.
    */
  private:
-  QList<Diff> diff_lineMode(QString text1, QString text2, clock_t deadline);
+  QList<Diff> diff_lineMode(QString text1, QString text2, clock_t deadline, qint64 memory) const;
 
   /**
    * Find the 'middle snake' of a diff, split the problem in two
@@ -229,10 +668,42 @@ class diff_match_patch {
    * See Myers 1986 paper: An O(ND) Difference Algorithm and Its Variations.
    * @param text1 Old string to be diffed.
    * @param text2 New string to be diffed.
+   * @param deadline Time at which to bail if not yet complete.
    * @return Linked List of Diff objects.
    */
  protected:
-  QList<Diff> diff_bisect(const QString &text1, const QString &text2, clock_t deadline);
+  QList<Diff> diff_bisect(const QString &text1, const QString &text2, clock_t deadline) const;
+
+  /**
+   * Find the 'middle snake' of a diff, split the problem in two
+   * and return the recursively constructed diff.
+   * @param text1 Old string to be diffed.
+   * @param text2 New string to be diffed.
+   * @param deadline Time at which to bail if not yet complete.
+   * @param memory Approximate bytes already held by the callers.
+   * @return Linked List of Diff objects.
+   */
+ private:
+  QList<Diff> diff_bisect(const QString &text1, const QString &text2, clock_t deadline, qint64 memory) const;
+
+  /**
+   * Approximate number of bytes diff_bisect allocates for its two
+   * diagonal vectors.
+   * @param text1 Old string to be diffed.
+   * @param text2 New string to be diffed.
+   * @return Number of bytes.
+   */
+ private:
+  static qint64 diff_bisectMemory(const QString &text1, const QString &text2);
+
+  /**
+   * Would holding 'cost' more bytes on top of 'memory' exceed Diff_MaxMemory?
+   * @param memory Approximate bytes already held.
+   * @param cost Approximate bytes about to be allocated.
+   * @return True if the budget would be exceeded.
+   */
+ private:
+  bool diff_overBudget(qint64 memory, qint64 cost) const;
 
   /**
    * Given the location of the 'middle snake', split the diff in two parts
@@ -242,10 +713,11 @@ class diff_match_patch {
    * @param x Index of split point in text1.
    * @param y Index of split point in text2.
    * @param deadline Time at which to bail if not yet complete.
+   * @param memory Approximate bytes already held by the callers.
    * @return LinkedList of Diff objects.
    */
  private:
-  QList<Diff> diff_bisectSplit(const QString &text1, const QString &text2, int x, int y, clock_t deadline);
+  QList<Diff> diff_bisectSplit(const QString &text1, const QString &text2, int x, int y, clock_t deadline, qint64 memory) const;
 
   /**
    * Split two texts into a list of strings.  Reduce the texts to a string of
@@ -257,7 +729,7 @@ class diff_match_patch {
    *     of the List of unique strings is intentionally blank.
    */
  protected:
-  QList<QVariant> diff_linesToChars(const QString &text1, const QString &text2); // return elems 0 and 1 are QString, elem 2 is QStringList
+  QList<QVariant> diff_linesToChars(const QString &text1, const QString &text2) const; // return elems 0 and 1 are QString, elem 2 is QStringList
 
   /**
    * Split a text into a list of strings.  Reduce the texts to a string of
@@ -269,7 +741,7 @@ class diff_match_patch {
    */
  private:
   QString diff_linesToCharsMunge(const QString &text, QStringList &lineArray,
-                                 QMap<QString, int> &lineHash);
+                                 QMap<QString, int> &lineHash) const;
 
   /**
    * Rehydrate the text in a diff from a string of line hashes to real lines of
@@ -278,7 +750,7 @@ class diff_match_patch {
    * @param lineArray List of unique strings.
    */
  private:
-  void diff_charsToLines(QList<Diff> &diffs, const QStringList &lineArray);
+  void diff_charsToLines(QList<Diff> &diffs, const QStringList &lineArray) const;
 
   /**
    * Determine the common prefix of two strings.
@@ -287,7 +759,7 @@ class diff_match_patch {
    * @return The number of characters common to the start of each string.
    */
  public:
-  int diff_commonPrefix(const QString &text1, const QString &text2);
+  int diff_commonPrefix(const QString &text1, const QString &text2) const;
 
   /**
    * Determine the common suffix of two strings.
@@ -296,7 +768,7 @@ class diff_match_patch {
    * @return The number of characters common to the end of each string.
    */
  public:
-  int diff_commonSuffix(const QString &text1, const QString &text2);
+  int diff_commonSuffix(const QString &text1, const QString &text2) const;
 
   /**
    * Determine if the suffix of one string is the prefix of another.
@@ -306,7 +778,7 @@ class diff_match_patch {
    *     string and the start of the second string.
    */
  protected:
-  int diff_commonOverlap(const QString &text1, const QString &text2);
+  int diff_commonOverlap(const QString &text1, const QString &text2) const;
 
   /**
    * Do the two texts share a substring which is at least half the length of
@@ -319,7 +791,7 @@ class diff_match_patch {
    *     common middle.  Or null if there was no match.
    */
  protected:
-  QStringList diff_halfMatch(const QString &text1, const QString &text2);
+  QStringList diff_halfMatch(const QString &text1, const QString &text2) const;
 
   /**
    * Does a substring of shorttext exist within longtext such that the
@@ -332,14 +804,14 @@ class diff_match_patch {
    *     and the common middle.  Or null if there was no match.
    */
  private:
-  QStringList diff_halfMatchI(const QString &longtext, const QString &shorttext, int i);
+  QStringList diff_halfMatchI(const QString &longtext, const QString &shorttext, int i) const;
 
   /**
    * Reduce the number of edits by eliminating semantically trivial equalities.
    * @param diffs LinkedList of Diff objects.
    */
  public:
-  void diff_cleanupSemantic(QList<Diff> &diffs);
+  void diff_cleanupSemantic(QList<Diff> &diffs) const;
 
   /**
    * Look for single edits surrounded on both sides by equalities
@@ -348,7 +820,7 @@ class diff_match_patch {
    * @param diffs LinkedList of Diff objects.
    */
  public:
-  void diff_cleanupSemanticLossless(QList<Diff> &diffs);
+  void diff_cleanupSemanticLossless(QList<Diff> &diffs) const;
 
   /**
    * Given two strings, compute a score representing whether the internal
@@ -359,14 +831,33 @@ class diff_match_patch {
    * @return The score.
    */
  private:
-  int diff_cleanupSemanticScore(const QString &one, const QString &two);
+  int diff_cleanupSemanticScore(const QString &one, const QString &two) const;
+
+  /**
+   * Does the text end with a blank line?  Equivalent to the regex /\n\r?\n$/
+   * but reads the string without touching any shared matcher state.
+   * @param text String to check.
+   * @return True if text ends with a blank line.
+   */
+ private:
+  static bool diff_blankLineEnd(const QString &text);
+
+  /**
+   * Does the text start with a blank line?  Equivalent to the regex
+   * /^\r?\n\r?\n/ but reads the string without touching any shared
+   * matcher state.
+   * @param text String to check.
+   * @return True if text starts with a blank line.
+   */
+ private:
+  static bool diff_blankLineStart(const QString &text);
 
   /**
    * Reduce the number of edits by eliminating operationally trivial equalities.
    * @param diffs LinkedList of Diff objects.
    */
  public:
-  void diff_cleanupEfficiency(QList<Diff> &diffs);
+  void diff_cleanupEfficiency(QList<Diff> &diffs) const;
 
   /**
    * Reorder and merge like edit sections.  Merge equalities.
@@ -374,7 +865,7 @@ class diff_match_patch {
    * @param diffs LinkedList of Diff objects.
    */
  public:
-  void diff_cleanupMerge(QList<Diff> &diffs);
+  void diff_cleanupMerge(QList<Diff> &diffs) const;
 
   /**
    * loc is a location in text1, compute and return the equivalent location in
@@ -385,7 +876,7 @@ class diff_match_patch {
    * @return Location within text2.
    */
  public:
-  int diff_xIndex(const QList<Diff> &diffs, int loc);
+  int diff_xIndex(const QList<Diff> &diffs, int loc) const;
 
   /**
    * Convert a Diff list into a pretty HTML report.
@@ -393,7 +884,29 @@ class diff_match_patch {
    * @return HTML representation.
    */
  public:
-  QString diff_prettyHtml(const QList<Diff> &diffs);
+  QString diff_prettyHtml(const QList<Diff> &diffs) const;
+
+  /**
+   * Stream a Diff list as a pretty HTML report to a device.
+   * The report is identical to diff_prettyHtml() encoded as UTF-8, but is
+   * written a chunk at a time so it is never held in memory as a whole.
+   * @param diffs LinkedList of Diff objects.
+   * @param device Open, writable device.
+   * @return True if every write succeeded.
+   */
+ public:
+  bool diff_prettyHtml(const QList<Diff> &diffs, QIODevice *device) const;
+
+  /**
+   * Stream a Diff list as a pretty HTML report to a callback.
+   * Concatenating the chunks gives the result of diff_prettyHtml().
+   * @param diffs LinkedList of Diff objects.
+   * @param sink Function called with each chunk of HTML.
+   * @param context Passed through to the sink untouched.
+   */
+ public:
+  void diff_prettyHtml(const QList<Diff> &diffs, TextSink sink,
+                       void *context) const;
 
   /**
    * Compute and return the source text (all equalities and deletions).
@@ -401,7 +914,7 @@ class diff_match_patch {
    * @return Source text.
    */
  public:
-  QString diff_text1(const QList<Diff> &diffs);
+  QString diff_text1(const QList<Diff> &diffs) const;
 
   /**
    * Compute and return the destination text (all equalities and insertions).
@@ -409,7 +922,7 @@ class diff_match_patch {
    * @return Destination text.
    */
  public:
-  QString diff_text2(const QList<Diff> &diffs);
+  QString diff_text2(const QList<Diff> &diffs) const;
 
   /**
    * Compute the Levenshtein distance; the number of inserted, deleted or
@@ -418,7 +931,33 @@ class diff_match_patch {
    * @return Number of changes.
    */
  public:
-  int diff_levenshtein(const QList<Diff> &diffs);
+  int diff_levenshtein(const QList<Diff> &diffs) const;
+
+  /**
+   * Compute the Levenshtein distance between two texts without building a
+   * diff.  Uses the bit-parallel algorithm of Myers (1999) in Hyyro's
+   * formulation, 64 rows per machine word, with as many words as the shorter
+   * text needs.
+   * Unlike diff_levenshtein, which scores an existing diff, this is the exact
+   * minimum number of inserted, deleted or substituted characters.
+   * @param text1 First string.
+   * @param text2 Second string.
+   * @return Number of changes.
+   */
+ public:
+  int diff_distance(const QString &text1, const QString &text2) const;
+
+  /**
+   * Compute the Levenshtein distance between two texts, giving up as soon as
+   * it is known to exceed a bound.
+   * @param text1 First string.
+   * @param text2 Second string.
+   * @param maxDistance Largest distance of interest (negative for no limit).
+   * @return Number of changes, or -1 if it is greater than maxDistance.
+   */
+ public:
+  int diff_distance(const QString &text1, const QString &text2,
+                    int maxDistance) const;
 
   /**
    * Crush the diff into an encoded string which describes the operations
@@ -429,7 +968,7 @@ class diff_match_patch {
    * @return Delta text.
    */
  public:
-  QString diff_toDelta(const QList<Diff> &diffs);
+  QString diff_toDelta(const QList<Diff> &diffs) const;
 
   /**
    * Given the original text1, and an encoded string which describes the
@@ -440,7 +979,86 @@ class diff_match_patch {
    * @throws QString If invalid input.
    */
  public:
-  QList<Diff> diff_fromDelta(const QString &text1, const QString &delta);
+  QList<Diff> diff_fromDelta(const QString &text1, const QString &delta) const;
+
+  /**
+   * Parse a delta without its source text.
+   * @param text1 Source string for the diff, or ignored if lengths is set.
+   * @param delta Delta text.
+   * @param lengths If not NULL, receives the length of every diff, and
+   *     equalities and deletions are returned with empty text.
+   * @return Array of diff tuples.
+   * @throws QString If invalid input.
+   */
+ private:
+  QList<Diff> diff_fromDelta(const QString &text1, const QString &delta,
+                             QVector<int> *lengths) const;
+
+  /**
+   * Combine the diff from A to B with the diff from B to C into the diff
+   * from A to C, without rebuilding B.  Runs in time linear in the number
+   * of diffs, then merges the result with diff_cleanupMerge().
+   * @param diffsAB Array of diff tuples turning A into B.
+   * @param diffsBC Array of diff tuples turning B into C.
+   * @return Array of diff tuples turning A into C.
+   * @throws QString If the two diffs disagree on the length of B.
+   */
+ public:
+  QList<Diff> diff_compose(const QList<Diff> &diffsAB,
+                           const QList<Diff> &diffsBC) const;
+
+  /**
+   * Combine two deltas from diff_toDelta() into one.
+   * @param text1 Source string A of the first delta.
+   * @param deltaAB Delta turning A into B.
+   * @param deltaBC Delta turning B into C.
+   * @return Delta turning A into C.
+   * @throws QString If invalid input.
+   */
+ public:
+  QString diff_compose(const QString &text1, const QString &deltaAB,
+                       const QString &deltaBC) const;
+
+  /**
+   * Combine two diffs, given the length in B of each diff of the second.
+   * @param diffsAB Array of diff tuples turning A into B.
+   * @param diffsBC Array of diff tuples turning B into C; only the text of
+   *     insertions is read.
+   * @param lengthsBC Length of each diff in diffsBC.
+   * @return Array of diff tuples turning A into C.
+   * @throws QString If the two diffs disagree on the length of B.
+   */
+ private:
+  QList<Diff> diff_compose(const QList<Diff> &diffsAB,
+                           const QList<Diff> &diffsBC,
+                           const QVector<int> &lengthsBC) const;
+
+  /**
+   * Crush the diff into a compact binary encoding; the binary counterpart of
+   * diff_toDelta().
+   * The first byte is the format version (1).  Each diff follows as a
+   * varint (7 bits per byte, least significant first) holding
+   * (length << 2) | op, where op is 0 for an equality, 1 for a deletion and
+   * 2 for an insertion.  Equality and deletion lengths count characters of
+   * text1; an insertion's length counts the bytes of its UTF-8 text, which
+   * follows immediately.
+   * @param diffs Array of diff tuples.
+   * @return Binary delta.
+   */
+ public:
+  QByteArray diff_toBinaryDelta(const QList<Diff> &diffs) const;
+
+  /**
+   * Given the original text1 and a binary delta from diff_toBinaryDelta(),
+   * compute the full diff.
+   * @param text1 Source string for the diff.
+   * @param delta Binary delta.
+   * @return Array of diff tuples.
+   * @throws QString If invalid input.
+   */
+ public:
+  QList<Diff> diff_fromBinaryDelta(const QString &text1,
+                                   const QByteArray &delta) const;
 
 
   //  MATCH FUNCTIONS
@@ -455,7 +1073,67 @@ class diff_match_patch {
    * @return Best match index or -1.
    */
  public:
-  int match_main(const QString &text, const QString &pattern, int loc);
+  int match_main(const QString &text, const QString &pattern, int loc) const;
+
+  /**
+   * Locate the best instance of 'pattern' in a prepared text near 'loc'.
+   * Returns the same as match_main() on the text itself.  Exact matches are
+   * looked up in the index, and a search is rejected without the bitap when
+   * too few of the pattern's q-grams occur within Match_Distance of 'loc'
+   * for any match to score under Match_Threshold.
+   * @param text The prepared text to search.
+   * @param pattern The pattern to search for.
+   * @param loc The location to search around.
+   * @return Best match index or -1.
+   */
+ public:
+  int match_main(const PreparedText &text, const QString &pattern,
+                 int loc) const;
+
+  /**
+   * Locate the best instance of 'pattern' in a text being patched near
+   * 'loc'.  Returns the same as match_main() on the whole text, but reads
+   * only as far as the search can reach, apart from the rare case of an
+   * exact match before 'loc' and none nearby after it.
+   * @param text The text to search.
+   * @param pattern The pattern to search for.
+   * @param alphabet The pattern's alphabet.
+   * @param loc The location to search around.
+   * @param maxBits Longest pattern allowed (0 for any length), as
+   *     Match_MaxBits was when the patches were compiled.
+   * @param rows Scratch space; grown as needed and kept for the next call.
+   * @return Best match index or -1.
+   */
+ private:
+  int match_main(TextBuffer &text, const QString &pattern,
+                 const MatchAlphabet &alphabet, int loc, int maxBits,
+                 QVector<quint64> &rows) const;
+
+  /**
+   * Locate the best instance of each pattern in 'text' near its own location.
+   * Gives the same answers as calling match_main() for each pair, but finds
+   * the exact occurrences of same-length patterns in one pass over the text.
+   * @param text The text to search.
+   * @param patterns The patterns to search for.
+   * @param locs The location to search around, one for each pattern.
+   * @return Best match index or -1 for each pattern, in order.
+   */
+ public:
+  QList<int> match_many(const QString &text, const QStringList &patterns,
+                        const QList<int> &locs) const;
+
+  /**
+   * Locate the best instance of 'pattern' in 'text' near 'loc', reusing the
+   * caller's scratch space for the bitap rows.
+   * @param text The text to search.
+   * @param pattern The pattern to search for.
+   * @param loc The location to search around.
+   * @param rows Scratch space; grown as needed and kept for the next call.
+   * @return Best match index or -1.
+   */
+ private:
+  int match_main(const QString &text, const QString &pattern, int loc,
+                 QVector<quint64> &rows) const;
 
   /**
    * Locate the best instance of 'pattern' in 'text' near 'loc' using the
@@ -466,7 +1144,41 @@ class diff_match_patch {
    * @return Best match index or -1.
    */
  protected:
-  int match_bitap(const QString &text, const QString &pattern, int loc);
+  int match_bitap(const QString &text, const QString &pattern, int loc) const;
+
+  /**
+   * Locate the best instance of 'pattern' in 'text' near 'loc' using the
+   * Bitap algorithm, reusing the caller's scratch space for the rows.
+   * @param text The text to search.
+   * @param pattern The pattern to search for.
+   * @param loc The location to search around.
+   * @param rows Scratch space; grown as needed and kept for the next call.
+   * @return Best match index or -1.
+   */
+ private:
+  int match_bitap(const QString &text, const QString &pattern, int loc,
+                  QVector<quint64> &rows) const;
+
+  /**
+   * Bitap search given the nearest exact matches of 'pattern' around 'loc',
+   * which bound the score worth searching for.  Only the characters the
+   * search can reach are read, so 'text' need only run that far.
+   * @param text The text to search.
+   * @param textLength Length of the whole text.
+   * @param pattern The pattern to search for.
+   * @param alphabet The pattern's alphabet.
+   * @param loc The location to search around.
+   * @param after First exact match at or after loc, or -1.
+   * @param before Last exact match at or before loc + pattern length, or -1.
+   *     Ignored when 'after' is -1.
+   * @param maxBits Longest pattern allowed (0 for any length).
+   * @param rows Scratch space; grown as needed and kept for the next call.
+   * @return Best match index or -1.
+   */
+ private:
+  int match_bitap(const QChar *text, int textLength, const QString &pattern,
+                  const MatchAlphabet &alphabet, int loc, int after,
+                  int before, int maxBits, QVector<quint64> &rows) const;
 
   /**
    * Compute and return the score for a match with e errors and x location.
@@ -477,7 +1189,7 @@ class diff_match_patch {
    * @return Overall score for match (0.0 = good, 1.0 = bad).
    */
  private:
-  double match_bitapScore(int e, int x, int loc, const QString &pattern);
+  double match_bitapScore(int e, int x, int loc, const QString &pattern) const;
 
   /**
    * Initialise the alphabet for the Bitap algorithm.
@@ -485,7 +1197,7 @@ class diff_match_patch {
    * @return Hash of character locations.
    */
  protected:
-  QMap<QChar, int> match_alphabet(const QString &pattern);
+  QMap<QChar, int> match_alphabet(const QString &pattern) const;
 
 
  //  PATCH FUNCTIONS
@@ -498,7 +1210,26 @@ class diff_match_patch {
    * @param text Source text.
    */
  protected:
-  void patch_addContext(Patch &patch, const QString &text);
+  void patch_addContext(Patch &patch, const QString &text) const;
+
+  /**
+   * Increase the context until it is unique, reading the source text in two
+   * pieces instead of joined: the first 'head' characters of 'patched',
+   * followed by 'original' from 'tail' onwards.
+   * @param patch The patch to grow.
+   * @param patched Text supplying the start of the source.
+   * @param head Number of characters taken from 'patched'.
+   * @param original Text supplying the rest of the source.
+   * @param tail Where the rest starts in 'original'.
+   * @param indexes NULL to scan for the uniqueness check.  Otherwise the
+   *     indexes of 'patched' and 'original', in that order, which are built
+   *     here the first time a context has to grow, then kept for the next
+   *     patch of the same texts.
+   */
+ private:
+  void patch_addContext(Patch &patch, const QString &patched, int head,
+                        const QString &original, int tail,
+                        QList<PreparedText> *indexes) const;
 
   /**
    * Compute a list of patches to turn text1 into text2.
@@ -508,7 +1239,7 @@ class diff_match_patch {
    * @return LinkedList of Patch objects.
    */
  public:
-  QList<Patch> patch_make(const QString &text1, const QString &text2);
+  QList<Patch> patch_make(const QString &text1, const QString &text2) const;
 
   /**
    * Compute a list of patches to turn text1 into text2.
@@ -517,7 +1248,7 @@ class diff_match_patch {
    * @return LinkedList of Patch objects.
    */
  public:
-  QList<Patch> patch_make(const QList<Diff> &diffs);
+  QList<Patch> patch_make(const QList<Diff> &diffs) const;
 
   /**
    * Compute a list of patches to turn text1 into text2.
@@ -529,7 +1260,7 @@ class diff_match_patch {
    * @deprecated Prefer patch_make(const QString &text1, const QList<Diff> &diffs).
    */
  public:
-  QList<Patch> patch_make(const QString &text1, const QString &text2, const QList<Diff> &diffs);
+  QList<Patch> patch_make(const QString &text1, const QString &text2, const QList<Diff> &diffs) const;
 
   /**
    * Compute a list of patches to turn text1 into text2.
@@ -539,7 +1270,7 @@ class diff_match_patch {
    * @return LinkedList of Patch objects.
    */
  public:
-  QList<Patch> patch_make(const QString &text1, const QList<Diff> &diffs);
+  QList<Patch> patch_make(const QString &text1, const QList<Diff> &diffs) const;
 
   /**
    * Given an array of patches, return another array that is identical.
@@ -547,7 +1278,7 @@ class diff_match_patch {
    * @return Array of patch objects.
    */
  public:
-  QList<Patch> patch_deepCopy(QList<Patch> &patches);
+  QList<Patch> patch_deepCopy(const QList<Patch> &patches) const;
 
   /**
    * Merge a set of patches onto the text.  Return a patched text, as well
@@ -558,7 +1289,43 @@ class diff_match_patch {
    *      boolean values.
    */
  public:
-  QPair<QString,QVector<bool> > patch_apply(QList<Patch> &patches, const QString &text);
+  QPair<QString,QVector<bool> > patch_apply(const QList<Patch> &patches, const QString &text) const;
+
+  /**
+   * Prepare a set of patches for patch_apply(), once for many texts.
+   * Match_MaxBits and Patch_Margin are read now; the other settings when
+   * the set is applied.
+   * @param patches Array of patch objects.
+   * @return The compiled set; the patches themselves are not changed.
+   */
+ public:
+  CompiledPatchSet patch_compile(const QList<Patch> &patches) const;
+
+  /**
+   * Merge a compiled set of patches onto the text.  Same as patch_apply()
+   * with the patches the set was compiled from.
+   * @param patches Compiled patch set.
+   * @param text Old text.
+   * @return Two element Object array, containing the new text and an array of
+   *      boolean values.
+   */
+ public:
+  QPair<QString,QVector<bool> > patch_apply(const CompiledPatchSet &patches, const QString &text) const;
+
+  /**
+   * Merge a compiled set of patches onto each of many texts, spread over
+   * the calling thread and whichever threads of a pool are free.  It may be
+   * called from a thread of the same pool.  The settings must not change
+   * until it returns.
+   * @param patches Compiled patch set, shared by every thread.
+   * @param texts Old texts, none of them null.
+   * @param pool Pool to run on, or NULL for QThreadPool::globalInstance().
+   * @return For each text in order, the new text and an array of boolean
+   *      values as patch_apply() returns them.
+   * @throws The exception applying to the first failed text threw.
+   */
+ public:
+  QList<QPair<QString,QVector<bool> > > patch_apply(const CompiledPatchSet &patches, const QStringList &texts, QThreadPool *pool = NULL) const;
 
   /**
    * Add some padding on text start and end so that edges can match something.
@@ -567,7 +1334,7 @@ class diff_match_patch {
    * @return The padding string added to each side.
    */
  public:
-  QString patch_addPadding(QList<Patch> &patches);
+  QString patch_addPadding(QList<Patch> &patches) const;
 
   /**
    * Look through the patches and break up any which are longer than the
@@ -576,7 +1343,7 @@ class diff_match_patch {
    * @param patches LinkedList of Patch objects.
    */
  public:
-  void patch_splitMax(QList<Patch> &patches);
+  void patch_splitMax(QList<Patch> &patches) const;
 
   /**
    * Take a list of patches and return a textual representation.
@@ -584,7 +1351,29 @@ class diff_match_patch {
    * @return Text representation of patches.
    */
  public:
-  QString patch_toText(const QList<Patch> &patches);
+  QString patch_toText(const QList<Patch> &patches) const;
+
+  /**
+   * Stream a list of patches in textual form to a device.
+   * The text is identical to patch_toText() encoded as UTF-8, but is
+   * written a chunk at a time so it is never held in memory as a whole.
+   * @param patches List of Patch objects.
+   * @param device Open, writable device.
+   * @return True if every write succeeded.
+   */
+ public:
+  bool patch_toText(const QList<Patch> &patches, QIODevice *device) const;
+
+  /**
+   * Stream a list of patches in textual form to a callback.
+   * Concatenating the chunks gives the result of patch_toText().
+   * @param patches List of Patch objects.
+   * @param sink Function called with each chunk of text.
+   * @param context Passed through to the sink untouched.
+   */
+ public:
+  void patch_toText(const QList<Patch> &patches, TextSink sink,
+                    void *context) const;
 
   /**
    * Parse a textual representation of patches and return a List of Patch
@@ -594,7 +1383,7 @@ class diff_match_patch {
    * @throws QString If invalid input.
    */
  public:
-  QList<Patch> patch_fromText(const QString &textline);
+  QList<Patch> patch_fromText(const QString &textline) const;
 
   /**
    * A safer version of QString.mid(pos).  This one returns "" instead of
@@ -622,4 +1411,98 @@ class diff_match_patch {
   }
 };
 
+
+/**
+ * Index of documents for picking a good diff base.
+ * Each document is reduced to a MinHash sketch of its character q-grams, and
+ * the sketches are bucketed by locality-sensitive hashing so that documents
+ * which share many q-grams with a query are found without diffing anything.
+ * Documents may be added at any time; they are numbered in insertion order.
+ * Queries are const and may run concurrently, but not alongside an insert.
+ */
+class SimilarityIndex {
+ public:
+  /**
+   * Constructor.  Initializes an empty index with default settings:
+   * 4-character q-grams and 64 hashes in 16 bands of 4.
+   */
+  SimilarityIndex();
+
+  /**
+   * Constructor.  Initializes an empty index.
+   * @param qgramLength Number of characters in each q-gram.
+   * @param bands Number of LSH bands.
+   * @param rows Number of hashes in each band.  The sketch holds
+   *     bands * rows hashes.
+   */
+  SimilarityIndex(int qgramLength, int bands, int rows);
+
+  /**
+   * Add a document to the index.
+   * @param text Document to add.
+   * @return The document's number, counting from 0 in insertion order.
+   */
+  int insert(const QString &text);
+
+  /**
+   * Number of documents in the index.
+   * @return Document count.
+   */
+  int size() const;
+
+  /**
+   * Find the indexed documents most similar to a text.
+   * Documents which share an LSH bucket with the text are ranked first;
+   * if there are fewer than 'count' of those, every document is ranked.
+   * @param text The text to look up.
+   * @param count Maximum number of results.
+   * @return Pairs of document number and estimated Jaccard similarity of the
+   *     q-gram sets (0.0 to 1.0), best first.  Ties go to the most recently
+   *     inserted document.
+   */
+  QList<QPair<int, double> > nearest(const QString &text, int count) const;
+
+  /**
+   * Estimate the similarity of two texts from their sketches.
+   * @param text1 First string.
+   * @param text2 Second string.
+   * @return Estimated Jaccard similarity of the q-gram sets (0.0 to 1.0).
+   */
+  double similarity(const QString &text1, const QString &text2) const;
+
+ private:
+  /**
+   * Compute the MinHash sketch of a text.
+   * @param text The text to sketch.
+   * @return bands * rows minimum hash values.
+   */
+  QVector<quint32> sketch(const QString &text) const;
+
+  /**
+   * Hash one band of a sketch into a bucket key.
+   * @param sketch Sketch as returned by sketch().
+   * @param band Band number.
+   * @return Bucket key, unique to the band number.
+   */
+  quint64 bandKey(const quint32 *sketch, int band) const;
+
+  /**
+   * Fraction of hash values two sketches have in common.
+   * @param sketch1 First sketch.
+   * @param sketch2 Second sketch.
+   * @return Estimated Jaccard similarity.
+   */
+  double compare(const quint32 *sketch1, const quint32 *sketch2) const;
+
+  int qgramLength;
+  int bands;
+  int rows;
+  // One seed per hash function.
+  QVector<quint64> seeds;
+  // Sketches of all documents, bands * rows values each, in insertion order.
+  QVector<quint32> sketches;
+  // Documents in each LSH bucket.
+  QHash<quint64, QList<int> > buckets;
+};
+
 #endif // DIFF_MATCH_PATCH_H
@@ -46,29 +46,40 @@ void diff_match_patch_test::run_all_tests() {
     testDiffLinesToChars();
     testDiffCharsToLines();
     testDiffCleanupMerge();
+    testDiffBlankLine();
     testDiffCleanupSemanticLossless();
     testDiffCleanupSemantic();
     testDiffCleanupEfficiency();
     testDiffPrettyHtml();
     testDiffText();
     testDiffDelta();
+    testDiffCompose();
     testDiffXIndex();
     testDiffLevenshtein();
+    testDiffDistance();
     testDiffBisect();
     testDiffMain();
+    testSimilarityIndex();
 
     testMatchAlphabet();
     testMatchBitap();
     testMatchMain();
+    testPreparedText();
+    testTextSearch();
+    testMatchMany();
 
     testPatchObj();
     testPatchFromText();
     testPatchToText();
+    testPatchReader();
     testPatchAddContext();
     testPatchMake();
     testPatchSplitMax();
     testPatchAddPadding();
     testPatchApply();
+    testPatchCompile();
+    testPatchApplyBatch();
+    testTextBuffer();
     qDebug("All tests passed.");
   } catch (QString strCase) {
     qDebug("Test failed: %s", qPrintable(strCase));
@@ -279,6 +290,24 @@ void diff_match_patch_test::testDiffCleanupMerge() {
   assertEquals("diff_cleanupMerge: Slide edit right recursive.", diffList(Diff(EQUAL, "xca"), Diff(DELETE, "cba")), diffs);
 }
 
+void diff_match_patch_test::testDiffBlankLine() {
+  // Detect a blank line at either end, as the regexes /\n\r?\n$/ and
+  // /^\r?\n\r?\n/ would.
+  assertFalse("diff_blankLineEnd: Null case.", dmp.diff_blankLineEnd(""));
+  assertTrue("diff_blankLineEnd: LF LF.", dmp.diff_blankLineEnd("abc\n\n"));
+  assertTrue("diff_blankLineEnd: LF CRLF.", dmp.diff_blankLineEnd("abc\n\r\n"));
+  assertTrue("diff_blankLineEnd: CRLF CRLF.", dmp.diff_blankLineEnd("abc\r\n\r\n"));
+  assertFalse("diff_blankLineEnd: Lone CRLF.", dmp.diff_blankLineEnd("\r\n"));
+  assertFalse("diff_blankLineEnd: Not at end.", dmp.diff_blankLineEnd("\n\nabc"));
+
+  assertFalse("diff_blankLineStart: Null case.", dmp.diff_blankLineStart(""));
+  assertTrue("diff_blankLineStart: LF LF.", dmp.diff_blankLineStart("\n\nabc"));
+  assertTrue("diff_blankLineStart: LF CRLF.", dmp.diff_blankLineStart("\n\r\nabc"));
+  assertTrue("diff_blankLineStart: CRLF CRLF.", dmp.diff_blankLineStart("\r\n\r\nabc"));
+  assertFalse("diff_blankLineStart: Lone CRLF.", dmp.diff_blankLineStart("\r\n"));
+  assertFalse("diff_blankLineStart: Not at start.", dmp.diff_blankLineStart("abc\n\n"));
+}
+
 void diff_match_patch_test::testDiffCleanupSemanticLossless() {
   // Slide diffs to match logical boundaries.
   QList<Diff> diffs = diffList();
@@ -391,10 +420,55 @@ void diff_match_patch_test::testDiffCleanupEfficiency() {
   dmp.Diff_EditCost = 4;
 }
 
+static void appendChunk(const QString &chunk, void *context) {
+  static_cast<QStringList *>(context)->append(chunk);
+}
+
 void diff_match_patch_test::testDiffPrettyHtml() {
   // Pretty print.
   QList<Diff> diffs = diffList(Diff(EQUAL, "a\n"), Diff(DELETE, "<B>b</B>"), Diff(INSERT, "c&d"));
   assertEquals("diff_prettyHtml:", "<span>a&para;<br></span><del style=\"background:#ffe6e6;\">&lt;B&gt;b&lt;/B&gt;</del><ins style=\"background:#e6ffe6;\">c&amp;d</ins>", dmp.diff_prettyHtml(diffs));
+
+  // Stream to a callback.
+  QStringList chunks;
+  dmp.diff_prettyHtml(diffs, appendChunk, &chunks);
+  assertEquals("diff_prettyHtml: Callback.", dmp.diff_prettyHtml(diffs), chunks.join(""));
+
+  chunks.clear();
+  dmp.diff_prettyHtml(diffList(), appendChunk, &chunks);
+  assertEquals("diff_prettyHtml: Callback null case.", 0, chunks.size());
+
+  // Stream a report larger than one chunk, with a surrogate pair on the
+  // chunk boundary.
+  QString big = QString(diff_match_patch::SINK_CHUNK - 1, QChar('x')) + QString::fromUtf8("\xf0\x9f\x98\x80") + QString(20000, QChar('<'));
+  diffs = diffList(Diff(EQUAL, big), Diff(INSERT, "\n"));
+  chunks.clear();
+  dmp.diff_prettyHtml(diffs, appendChunk, &chunks);
+  assertTrue("diff_prettyHtml: Several chunks.", chunks.size() > 1);
+  assertEquals("diff_prettyHtml: Chunks.", dmp.diff_prettyHtml(diffs), chunks.join(""));
+
+  // Escapes many times longer than the text still give bounded chunks.
+  QList<Diff> newlines = diffList(Diff(EQUAL, QString(20000, QChar('\n'))));
+  for (int x = 0; x < 5000; x++) {
+    newlines.append(Diff(INSERT, ""));
+  }
+  chunks.clear();
+  dmp.diff_prettyHtml(newlines, appendChunk, &chunks);
+  int longest = 0;
+  foreach (const QString &chunk, chunks) {
+    longest = qMax(longest, chunk.length());
+  }
+  assertTrue("diff_prettyHtml: Chunk size bounded.", longest < 2 * diff_match_patch::SINK_CHUNK);
+  assertEquals("diff_prettyHtml: Escaped chunks.", dmp.diff_prettyHtml(newlines), chunks.join(""));
+
+  // Stream to a device.
+  QBuffer buffer;
+  buffer.open(QIODevice::WriteOnly);
+  assertTrue("diff_prettyHtml: Device.", dmp.diff_prettyHtml(diffs, &buffer));
+  assertTrue("diff_prettyHtml: Device UTF-8.", buffer.data() == dmp.diff_prettyHtml(diffs).toUtf8());
+
+  QBuffer closed;
+  assertFalse("diff_prettyHtml: Device not writable.", dmp.diff_prettyHtml(diffs, &closed));
 }
 
 void diff_match_patch_test::testDiffText() {
@@ -432,6 +506,32 @@ void diff_match_patch_test::testDiffDelta() {
     // Exception expected.
   }
 
+  // Generates error (invalid lengths).
+  try {
+    dmp.diff_fromDelta(text1, "=");
+    assertFalse("diff_fromDelta: Missing number.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+  try {
+    dmp.diff_fromDelta(text1, "=2x");
+    assertFalse("diff_fromDelta: Invalid number.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+  try {
+    dmp.diff_fromDelta(text1, "=99999999999");
+    assertFalse("diff_fromDelta: Number overflow.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+  try {
+    dmp.diff_fromDelta(text1, "=-1");
+    assertFalse("diff_fromDelta: Negative number.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+
   // Generates error (%c3%xy invalid Unicode).
   /* This test does not work because QUrl::fromPercentEncoding("%xy") -> "?"
   try {
@@ -462,6 +562,113 @@ void diff_match_patch_test::testDiffDelta() {
 
   // Convert delta string into a diff.
   assertEquals("diff_fromDelta: Unchanged characters.", diffs, dmp.diff_fromDelta("", delta));
+
+  // Every ASCII character, plus a character outside the BMP.
+  QString ascii;
+  for (int i = 0; i < 128; i++) {
+    ascii += QChar(i);
+  }
+  diffs = diffList(Diff(INSERT, ascii + QString::fromUtf8("\xf0\x9f\x98\x80")));
+  delta = dmp.diff_toDelta(diffs);
+  assertEquals("diff_toDelta: ASCII.", QString("+") + QString(QUrl::toPercentEncoding(diffs[0].text, " !~*'();/?:@&=+$,#")), delta);
+  assertEquals("diff_fromDelta: ASCII.", diffs, dmp.diff_fromDelta("", delta));
+
+  // An unpaired surrogate encodes as '?', like QString::toUtf8().
+  diffs = diffList(Diff(INSERT, QString("a") + QChar(0xd83d) + QString("b")));
+  assertEquals("diff_toDelta: Unpaired surrogate.", "+a?b", dmp.diff_toDelta(diffs));
+
+  // A '%' without two hex digits is kept as it is.
+  assertEquals("diff_fromDelta: Stray percent.", diffList(Diff(INSERT, "5% %4")), dmp.diff_fromDelta("", "+5% %4"));
+
+  // Binary deltas.
+  diffs = diffList(Diff(EQUAL, "jump"), Diff(DELETE, "s"), Diff(INSERT, "ed"), Diff(EQUAL, " over "), Diff(DELETE, "the"), Diff(INSERT, "a"), Diff(EQUAL, " lazy"), Diff(INSERT, "old dog"));
+  text1 = dmp.diff_text1(diffs);
+  QByteArray binary = dmp.diff_toBinaryDelta(diffs);
+  assertTrue("diff_toBinaryDelta:", binary == QByteArray("\x01\x10\x05\x0a" "ed" "\x18\x0d\x06" "a" "\x14\x1e" "old dog", 19));
+  assertEquals("diff_fromBinaryDelta:", diffs, dmp.diff_fromBinaryDelta(text1, binary));
+
+  assertTrue("diff_toBinaryDelta: Null case.", dmp.diff_toBinaryDelta(diffList()) == QByteArray("\x01", 1));
+  assertEquals("diff_fromBinaryDelta: Null case.", diffList(), dmp.diff_fromBinaryDelta("", QByteArray("\x01", 1)));
+
+  // Unicode inserts and lengths needing several varint bytes.
+  diffs = diffList(Diff(EQUAL, QString(300, QChar('x'))), Diff(INSERT, QString::fromWCharArray((const wchar_t*) L"\u0682 \002 \\ |", 7) + QString::fromUtf8("\xf0\x9f\x98\x80")));
+  binary = dmp.diff_toBinaryDelta(diffs);
+  assertEquals("diff_fromBinaryDelta: Unicode.", diffs, dmp.diff_fromBinaryDelta(QString(300, QChar('x')), binary));
+
+  // Generates error (bad version, truncated, overflow, wrong length).
+  try {
+    dmp.diff_fromBinaryDelta("", QByteArray("\x02", 1));
+    assertFalse("diff_fromBinaryDelta: Bad version.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+  try {
+    dmp.diff_fromBinaryDelta(QString(300, QChar('x')), binary.left(binary.size() - 1));
+    assertFalse("diff_fromBinaryDelta: Truncated.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+  try {
+    // Equal 1, padded to ten bytes with a bit past bit 63 set.
+    dmp.diff_fromBinaryDelta("x", QByteArray("\x01\x84\x80\x80\x80\x80\x80\x80\x80\x80\x02", 11));
+    assertFalse("diff_fromBinaryDelta: Varint overflow.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+  try {
+    dmp.diff_fromBinaryDelta(QString(299, QChar('x')), binary);
+    assertFalse("diff_fromBinaryDelta: Too long.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+  try {
+    dmp.diff_fromBinaryDelta(QString(301, QChar('x')), binary);
+    assertFalse("diff_fromBinaryDelta: Too short.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+}
+
+void diff_match_patch_test::testDiffCompose() {
+  // Combine A->B and B->C into A->C.
+  assertEquals("diff_compose: Null case.", diffList(), dmp.diff_compose(diffList(), diffList()));
+
+  QList<Diff> diffsAB = diffList(Diff(EQUAL, "ab"), Diff(INSERT, "X"), Diff(EQUAL, "cd"), Diff(DELETE, "e"));
+  QList<Diff> diffsBC = diffList(Diff(DELETE, "a"), Diff(EQUAL, "bX"), Diff(INSERT, "Y"), Diff(EQUAL, "c"), Diff(DELETE, "d"));
+  QList<Diff> diffs = diffList(Diff(DELETE, "a"), Diff(EQUAL, "b"), Diff(INSERT, "XY"), Diff(EQUAL, "c"), Diff(DELETE, "de"));
+  assertEquals("diff_compose: Mixed.", diffs, dmp.diff_compose(diffsAB, diffsBC));
+
+  // Text inserted then deleted disappears.
+  diffsAB = diffList(Diff(EQUAL, "a"), Diff(INSERT, "123"), Diff(EQUAL, "b"));
+  diffsBC = diffList(Diff(EQUAL, "a"), Diff(DELETE, "123"), Diff(EQUAL, "b"));
+  assertEquals("diff_compose: Round trip.", diffList(Diff(EQUAL, "ab")), dmp.diff_compose(diffsAB, diffsBC));
+
+  // Real diffs.
+  QString a = "The quick brown fox jumps over the lazy dog.";
+  QString b = "The quick red fox jumped over the lazy dog!";
+  QString c = "A quick red fox jumped over two lazy dogs!";
+  diffs = dmp.diff_compose(dmp.diff_main(a, b, false), dmp.diff_main(b, c, false));
+  assertEquals("diff_compose: Source text.", a, dmp.diff_text1(diffs));
+  assertEquals("diff_compose: Destination text.", c, dmp.diff_text2(diffs));
+
+  // Deltas.
+  QString delta = dmp.diff_compose(a, dmp.diff_toDelta(dmp.diff_main(a, b, false)), dmp.diff_toDelta(dmp.diff_main(b, c, false)));
+  assertEquals("diff_compose: Delta.", dmp.diff_toDelta(diffs), delta);
+  assertEquals("diff_compose: Delta destination.", c, dmp.diff_text2(dmp.diff_fromDelta(a, delta)));
+
+  // Generates error (B lengths differ).
+  try {
+    dmp.diff_compose(diffList(Diff(EQUAL, "abc")), diffList(Diff(EQUAL, "ab")));
+    assertFalse("diff_compose: Too short.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
+  try {
+    dmp.diff_compose(a, "=44", "=43");
+    assertFalse("diff_compose: Delta too short.", true);
+  } catch (QString ex) {
+    // Exception expected.
+  }
 }
 
 void diff_match_patch_test::testDiffXIndex() {
@@ -471,6 +678,27 @@ void diff_match_patch_test::testDiffXIndex() {
 
   diffs = diffList(Diff(EQUAL, "a"), Diff(DELETE, "1234"), Diff(EQUAL, "xyz"));
   assertEquals("diff_xIndex: Translation on deletion.", 1, dmp.diff_xIndex(diffs, 3));
+
+  // Precomputed index.
+  assertEquals("LocationIndex: Translation on deletion.", 1, LocationIndex(diffs).xIndex(3));
+  assertEquals("LocationIndex: Null case.", 4, LocationIndex(diffList()).xIndex(4));
+
+  diffs = diffList(Diff(INSERT, "AB"), Diff(EQUAL, "a"), Diff(DELETE, "bc"), Diff(INSERT, "C"), Diff(EQUAL, "de"), Diff(DELETE, "f"), Diff(INSERT, "DEF"));
+  LocationIndex locations(diffs);
+  QVector<int> locs;
+  QVector<int> expected;
+  for (int loc = 0; loc <= 8; loc++) {
+    locs.append(loc);
+    expected.append(dmp.diff_xIndex(diffs, loc));
+    assertEquals(QString("LocationIndex: Location %1.").arg(loc), expected.last(), locations.xIndex(loc));
+  }
+  assertTrue("LocationIndex: Sorted batch.", locations.xIndex(locs) == expected);
+
+  locs.clear();
+  locs << 5 << 1 << 2 << 7;
+  expected.clear();
+  expected << 6 << 3 << 3 << 10;
+  assertTrue("LocationIndex: Unsorted batch.", locations.xIndex(locs) == expected);
 }
 
 void diff_match_patch_test::testDiffLevenshtein() {
@@ -484,6 +712,48 @@ void diff_match_patch_test::testDiffLevenshtein() {
   assertEquals("diff_levenshtein: Middle equality.", 7, dmp.diff_levenshtein(diffs));
 }
 
+void diff_match_patch_test::testDiffDistance() {
+  // Compute the edit distance directly.
+  assertEquals("diff_distance: Null case.", 0, dmp.diff_distance("", ""));
+
+  assertEquals("diff_distance: Insertion only.", 3, dmp.diff_distance("", "abc"));
+
+  assertEquals("diff_distance: Deletion only.", 3, dmp.diff_distance("abc", ""));
+
+  assertEquals("diff_distance: Equality.", 0, dmp.diff_distance("abc", "abc"));
+
+  assertEquals("diff_distance: Substitutions and insertion.", 3, dmp.diff_distance("kitten", "sitting"));
+
+  assertEquals("diff_distance: Symmetric.", 3, dmp.diff_distance("sitting", "kitten"));
+
+  assertEquals("diff_distance: Unicode.", 4, dmp.diff_distance(QString::fromWCharArray((const wchar_t*) L"\u0680 \000 \t %", 7), QString::fromWCharArray((const wchar_t*) L"\u0681 \001 \n ^", 7)));
+
+  // Patterns longer than one 64-bit word.
+  QString a = "";
+  for (int x = 0; x < 15; x++) {
+    a += "abcdefghij";
+  }
+  QString b = a.left(10) + "X" + a.mid(11, 59) + "YY" + a.mid(70, 70) + a.mid(141);
+  assertEquals("diff_distance: Multiple words.", 4, dmp.diff_distance(a, b));
+
+  a = "";
+  b = "";
+  for (int x = 0; x < 4; x++) {
+    a += "The quick brown fox jumps over the lazy dog. ";
+    b += "That quick brown fox jumped over a lazy dog. ";
+  }
+  assertEquals("diff_distance: Multiple words, many edits.", 28, dmp.diff_distance(a, b));
+
+  // Bounded distance.
+  assertEquals("diff_distance: Within bound.", 3, dmp.diff_distance("kitten", "sitting", 3));
+
+  assertEquals("diff_distance: Beyond bound.", -1, dmp.diff_distance("kitten", "sitting", 2));
+
+  assertEquals("diff_distance: Length difference beyond bound.", -1, dmp.diff_distance("a", "abcdef", 4));
+
+  assertEquals("diff_distance: Multiple words beyond bound.", -1, dmp.diff_distance(a, b, 27));
+}
+
 void diff_match_patch_test::testDiffBisect() {
   // Normal.
   QString a = "cat";
@@ -581,6 +851,30 @@ void diff_match_patch_test::testDiffMain() {
   QStringList texts_textmode = diff_rebuildtexts(dmp.diff_main(a, b, false));
   assertEquals("diff_main: Overlap line-mode.", texts_textmode, texts_linemode);
 
+  // Test the memory budget.
+  dmp.Diff_MaxMemory = 1;
+  diffs = diffList(Diff(DELETE, "cat"), Diff(INSERT, "map"));
+  assertEquals("diff_main: Memory budget block replacement.", diffs, dmp.diff_main("cat", "map", false));
+
+  // Enough for a diff of the lines, not for a diff of their characters.
+  // Held text costs 2 bytes a character and diff_bisect 16 bytes for each
+  // (length1 + length2 + 1) / 2.  Trimmed of "alpha\na" and "\n", the
+  // 21 + 21 character middle needs 84 + 336 = 420 to bisect, so line mode
+  // runs.  Line mode holds 84 + 84, and bisecting the 3 + 3 line characters
+  // takes 168 + 12 + 48 = 228.  Rediffing the first changed line, 9 + 9
+  // characters once "\n" is trimmed, would take 168 + 36 + 144 = 348.  Any
+  // budget from 228 to 347 gives this result.
+  dmp.Diff_MaxMemory = 250;
+  a = "alpha\nabcdefghij\ngamma\ndelta\n";
+  b = "alpha\naXcXeXgXiX\ngamma\nDELTA\n";
+  diffs = diffList(Diff(EQUAL, "alpha\na"), Diff(DELETE, "bcdefghij"), Diff(INSERT, "XcXeXgXiX"), Diff(EQUAL, "\ngamma\n"), Diff(DELETE, "delta"), Diff(INSERT, "DELTA"), Diff(EQUAL, "\n"));
+  assertEquals("diff_main: Memory budget line-mode.", diffs, dmp.diff_main(a, b, true));
+
+  dmp.Diff_MaxMemory = 1024;
+  diffs = diffList(Diff(DELETE, "c"), Diff(INSERT, "m"), Diff(EQUAL, "a"), Diff(DELETE, "t"), Diff(INSERT, "p"));
+  assertEquals("diff_main: Memory budget sufficient.", diffs, dmp.diff_main("cat", "map", false));
+  dmp.Diff_MaxMemory = 0;
+
   // Test null inputs.
   try {
     dmp.diff_main(NULL, NULL);
@@ -591,6 +885,42 @@ void diff_match_patch_test::testDiffMain() {
 }
 
 
+void diff_match_patch_test::testSimilarityIndex() {
+  // Rank documents by MinHash similarity.
+  SimilarityIndex index;
+  assertEquals("SimilarityIndex: Empty index.", 0, index.nearest("abc", 3).size());
+
+  assertEquals("SimilarityIndex: Insert 0.", 0, index.insert("The quick brown fox jumps over the lazy dog."));
+  assertEquals("SimilarityIndex: Insert 1.", 1, index.insert("Lorem ipsum dolor sit amet, consectetur adipiscing elit."));
+  assertEquals("SimilarityIndex: Insert 2.", 2, index.insert("The quick brown fox jumped over the lazy cat."));
+  assertEquals("SimilarityIndex: Size.", 3, index.size());
+
+  QList<QPair<int, double> > results = index.nearest("The quick brown fox jumps over the lazy cat.", 2);
+  assertEquals("SimilarityIndex: Count.", 2, results.size());
+  assertTrue("SimilarityIndex: Nearest.", results[0].first == 0 || results[0].first == 2);
+  assertTrue("SimilarityIndex: Ordered.", results[0].second >= results[1].second);
+  assertTrue("SimilarityIndex: Unrelated.", results[1].first != 1);
+
+  results = index.nearest("Lorem ipsum dolor sit amet, consectetur adipiscing elit.", 1);
+  assertEquals("SimilarityIndex: Exact.", 1, results[0].first);
+  assertTrue("SimilarityIndex: Exact score.", results[0].second == 1.0);
+
+  // Fewer bucket hits than requested falls back to ranking everything.
+  results = index.nearest("zzzzzzzz", 3);
+  assertEquals("SimilarityIndex: Fallback.", 3, results.size());
+  assertEquals("SimilarityIndex: Tie goes to newest.", 2, results[0].first);
+
+  // Incremental insert.
+  assertEquals("SimilarityIndex: Insert 3.", 3, index.insert("zzzzzzzz"));
+  results = index.nearest("zzzzzzzz", 1);
+  assertEquals("SimilarityIndex: Inserted document.", 3, results[0].first);
+
+  assertTrue("SimilarityIndex: Identical.", index.similarity("abcdef", "abcdef") == 1.0);
+  assertTrue("SimilarityIndex: Disjoint.", index.similarity("abcdef", "uvwxyz") < 0.1);
+  assertTrue("SimilarityIndex: Short text.", index.similarity("ab", "ab") == 1.0);
+}
+
+
 //  MATCH TEST FUNCTIONS
 
 
@@ -607,6 +937,18 @@ void diff_match_patch_test::testMatchAlphabet() {
   bitmask.insert('b', 18);
   bitmask.insert('c', 8);
   assertEquals("match_alphabet: Duplicates.", bitmask, dmp.match_alphabet("abcaba"));
+
+  // Flat table and sorted array agree with the map.
+  QString pattern = QString::fromWCharArray((const wchar_t*) L"a\u0680b\u00e9\u0680\u4e2da", 7);
+  MatchAlphabet alphabet(pattern);
+  bitmask = dmp.match_alphabet(pattern);
+  QMapIterator<QChar, int> i(bitmask);
+  while (i.hasNext()) {
+    i.next();
+    assertEquals(QString("MatchAlphabet: %1.").arg(i.key()), i.value(), int(alphabet.mask(i.key())[0]));
+  }
+  assertEquals("MatchAlphabet: Missing ASCII.", 0, int(alphabet.mask('z')[0]));
+  assertEquals("MatchAlphabet: Missing Unicode.", 0, int(alphabet.mask(QChar(0x0681))[0]));
 }
 
 void diff_match_patch_test::testMatchBitap() {
@@ -652,6 +994,44 @@ void diff_match_patch_test::testMatchBitap() {
 
   dmp.Match_Distance = 1000;  // Loose location.
   assertEquals("match_bitap: Distance test #3.", 0, dmp.match_bitap("abcdefghijklmnopqrstuvwxyz", "abcdefg", 24));
+
+  // Patterns longer than one machine word.
+  dmp.Match_MaxBits = 0;
+  QString alphabet = "abcdefghijklmnopqrstuvwxyz0123456789";
+  QString text = alphabet + alphabet + alphabet + alphabet;
+  QString pattern = alphabet.mid(4) + alphabet + alphabet.left(10);
+  assertEquals("match_bitap: 78 characters exact.", 40, dmp.match_bitap(text, pattern, 30));
+
+  pattern[20] = 'X';
+  pattern[50] = 'Y';
+  assertEquals("match_bitap: 78 characters fuzzy.", 40, dmp.match_bitap(text, pattern, 30));
+
+  pattern = alphabet.mid(4) + alphabet + alphabet + alphabet.left(10);
+  pattern.remove(60, 1);
+  assertEquals("match_bitap: 113 characters fuzzy.", 4, dmp.match_bitap(text, pattern, 0));
+
+  // Several words at once, with a partial word left over.
+  text = QString();
+  for (int x = 0; x < 12; x++) {
+    text += alphabet;
+  }
+  pattern = text.mid(40, 300);
+  assertEquals("match_bitap: 300 characters exact.", 40, dmp.match_bitap(text, pattern, 38));
+
+  pattern[5] = 'X';
+  pattern[150] = 'Y';
+  pattern[299] = 'Z';
+  pattern.remove(200, 1);
+  assertEquals("match_bitap: 300 characters fuzzy.", 40, dmp.match_bitap(text, pattern, 38));
+
+  dmp.Match_MaxBits = 64;
+  try {
+    dmp.match_bitap(text, pattern, 0);
+    assertFalse("match_bitap: Pattern too long.", true);
+  } catch (const char* ex) {
+    // Exception expected.
+  }
+  dmp.Match_MaxBits = 32;
 }
 
 void diff_match_patch_test::testMatchMain() {
@@ -677,6 +1057,123 @@ void diff_match_patch_test::testMatchMain() {
   }
 }
 
+void diff_match_patch_test::testPreparedText() {
+  // Exact lookups through the q-gram index.
+  QString text = "abcdefabcdefxyzabcdef";
+  PreparedText prepared(text);
+  assertEquals("PreparedText: Text.", text, prepared.text());
+  assertEquals("PreparedText: indexOf.", 6, prepared.indexOf("abcdef", 1));
+  assertEquals("PreparedText: indexOf at from.", 15, prepared.indexOf("abcdef", 15));
+  assertEquals("PreparedText: indexOf past end.", -1, prepared.indexOf("abcdef", 16));
+  assertEquals("PreparedText: indexOf missing.", -1, prepared.indexOf("abcdx", 0));
+  assertEquals("PreparedText: indexOf short.", 12, prepared.indexOf("xy", 0));
+  assertEquals("PreparedText: lastIndexOf.", 6, prepared.lastIndexOf("abcdef", 14));
+  assertEquals("PreparedText: lastIndexOf clipped.", 15, prepared.lastIndexOf("abcdef", 20));
+  assertEquals("PreparedText: lastIndexOf past end.", -1, prepared.lastIndexOf("abcdef", 21));
+  assertEquals("PreparedText: lastIndexOf none before.", -1, prepared.lastIndexOf("cdefx", 5));
+  assertEquals("PreparedText: sharedGrams.", 2, prepared.sharedGrams("defxyz", 3, 10));
+  assertEquals("PreparedText: sharedGrams all.", 3, prepared.sharedGrams("defxyz", 0, 20));
+
+  // Same answers as match_main.
+  text = "I am the very model of a modern major general.";
+  prepared = PreparedText(text);
+  assertEquals("match_main: Prepared equality.", 0, dmp.match_main(PreparedText("abcdef"), "abcdef", 1000));
+  assertEquals("match_main: Prepared null text.", -1, dmp.match_main(PreparedText(""), "abcdef", 1));
+  assertEquals("match_main: Prepared exact match.", 9, dmp.match_main(prepared, "very", 0));
+  assertEquals("match_main: Prepared fuzzy match.", 14, dmp.match_main(prepared, "modal", 20));
+  assertEquals("match_main: Prepared no match.", -1, dmp.match_main(prepared, "zyxwvutsrq", 20));
+  QStringList patterns;
+  patterns << " that berry " << "a modern" << "major genie" << "I am a" << "eneral." << "qqqq";
+  for (int x = 0; x < patterns.size(); x++) {
+    for (int loc = 0; loc <= text.length(); loc += 5) {
+      assertEquals(QString("match_main: Prepared %1 at %2.").arg(patterns[x]).arg(loc), dmp.match_main(text, patterns[x], loc), dmp.match_main(prepared, patterns[x], loc));
+    }
+  }
+  dmp.Match_Distance = 10;
+  assertEquals("match_main: Prepared out of reach.", -1, dmp.match_main(prepared, "general", 0));
+  dmp.Match_Distance = 1000;
+
+  // Test null inputs.
+  try {
+    dmp.match_main(PreparedText(NULL), "abc", 0);
+    assertFalse("match_main: Prepared null inputs.", true);
+  } catch (const char* ex) {
+    // Exception expected.
+  }
+}
+
+void diff_match_patch_test::testTextSearch() {
+  // Substring search, same results as QString.
+  QString text = "abcabcabcabcabcabcabcabcxyz";
+  assertEquals("TextSearch: indexOf.", 0, TextSearch::indexOf(text, "abc"));
+  assertEquals("TextSearch: indexOf from.", 3, TextSearch::indexOf(text, "abc", 1));
+  assertEquals("TextSearch: indexOf long.", 15, TextSearch::indexOf(text, "abcabcabcxyz"));
+  assertEquals("TextSearch: indexOf negative from.", 24, TextSearch::indexOf(text, "xyz", -3));
+  assertEquals("TextSearch: indexOf missing.", -1, TextSearch::indexOf(text, "abcb"));
+  assertEquals("TextSearch: indexOf too long.", -1, TextSearch::indexOf("ab", "abc"));
+  assertEquals("TextSearch: indexOf empty.", 5, TextSearch::indexOf(text, "", 5));
+  assertEquals("TextSearch: indexOf past end.", -1, TextSearch::indexOf(text, "", 28));
+  assertEquals("TextSearch: lastIndexOf.", 21, TextSearch::lastIndexOf(text, "abc"));
+  assertEquals("TextSearch: lastIndexOf from.", 18, TextSearch::lastIndexOf(text, "abc", 20));
+  assertEquals("TextSearch: lastIndexOf at end.", -1, TextSearch::lastIndexOf(text, "xyz", 27));
+  assertEquals("TextSearch: lastIndexOf empty.", 26, TextSearch::lastIndexOf(text, ""));
+  assertEquals("TextSearch: lastIndexOf missing.", -1, TextSearch::lastIndexOf(text, "cb"));
+  assertEquals("TextSearch: lastIndexOf char.", 25, TextSearch::lastIndexOf(text, "y"));
+
+  // Candidates sharing the first and last characters.
+  text = QString(40, 'a') + "ab" + QString(40, 'a');
+  assertEquals("TextSearch: indexOf near miss.", 38, TextSearch::indexOf(text, "aaab"));
+  assertEquals("TextSearch: lastIndexOf near miss.", 41, TextSearch::lastIndexOf(text, "baaa"));
+  assertEquals("TextSearch: indexOf self.", 0, TextSearch::indexOf(text, text));
+}
+
+void diff_match_patch_test::testMatchMany() {
+  // Batch of patterns, each with its own location.
+  QString text = "I am the very model of a modern major general.";
+  QStringList patterns;
+  patterns << "" << "very" << "model" << "modal" << "modal" << " that berry " << "xyz" << text;
+  QList<int> locs;
+  locs << 3 << 0 << 14 << 14 << 40 << 5 << 10 << 9;
+  QList<int> results = dmp.match_many(text, patterns, locs);
+  assertEquals("match_many: Count.", patterns.size(), results.size());
+  assertEquals("match_many: Null pattern.", 3, results[0]);
+  assertEquals("match_many: Exact match.", 9, results[1]);
+  assertEquals("match_many: Exact match at loc.", 14, results[2]);
+  assertEquals("match_many: Fuzzy match.", 14, results[3]);
+  assertEquals("match_many: Fuzzy match, loc past it.", 14, results[4]);
+  assertEquals("match_many: Complex match.", 4, results[5]);
+  assertEquals("match_many: No match.", -1, results[6]);
+  assertEquals("match_many: Equality.", 0, results[7]);
+
+  // Same answers as match_main, with many patterns of one length.
+  text = "abcxabcyabczabcxabcyabcz the quick brown fox jumps over the lazy dog abc";
+  patterns.clear();
+  locs.clear();
+  for (int x = 0; x + 4 <= text.length(); x += 3) {
+    QString pattern = text.mid(x, 4);
+    pattern[x % 4] = 'q';
+    patterns << pattern << text.mid(x, 4);
+    locs << (x * 7) % text.length() << text.length() - x;
+  }
+  results = dmp.match_many(text, patterns, locs);
+  for (int x = 0; x < patterns.size(); x++) {
+    assertEquals(QString("match_many: Pattern %1.").arg(x), dmp.match_main(text, patterns[x], locs[x]), results[x]);
+  }
+
+  // Empty text.
+  results = dmp.match_many("", QStringList() << "abc" << "", QList<int>() << 0 << 0);
+  assertEquals("match_many: Empty text.", -1, results[0]);
+  assertEquals("match_many: Empty text and pattern.", 0, results[1]);
+
+  // Mismatched counts.
+  try {
+    dmp.match_many(text, patterns, QList<int>());
+    assertFalse("match_many: Missing locations.", true);
+  } catch (const char* ex) {
+    // Exception expected.
+  }
+}
+
 
 //  PATCH TEST FUNCTIONS
 
@@ -723,6 +1220,108 @@ void diff_match_patch_test::testPatchToText() {
   strp = "@@ -1,9 +1,9 @@\n-f\n+F\n oo+fooba\n@@ -7,9 +7,9 @@\n obar\n-,\n+.\n  tes\n";
   patches = dmp.patch_fromText(strp);
   assertEquals("patch_toText: Dual", strp, dmp.patch_toText(patches));
+
+  // Stream to a callback.
+  QStringList chunks;
+  dmp.patch_toText(patches, appendChunk, &chunks);
+  assertEquals("patch_toText: Callback.", strp, chunks.join(""));
+
+  chunks.clear();
+  dmp.patch_toText(QList<Patch>(), appendChunk, &chunks);
+  assertEquals("patch_toText: Callback null case.", 0, chunks.size());
+
+  // Stream patches larger than one chunk, with surrogate pairs throughout.
+  QString big = QString("y");
+  for (int x = 0; x < 5000; x++) {
+    big += QString::fromUtf8("\xf0\x9f\x98\x80 %");
+  }
+  Patch patch;
+  patch.diffs.append(Diff(DELETE, big));
+  patch.diffs.append(Diff(INSERT, QString(20000, QChar('a'))));
+  patch.diffs.append(Diff(EQUAL, big));
+  patch.length1 = 2 * big.length();
+  patch.length2 = big.length() + 20000;
+  patches.append(patch);
+  patches.append(patch);
+  chunks.clear();
+  dmp.patch_toText(patches, appendChunk, &chunks);
+  assertTrue("patch_toText: Several chunks.", chunks.size() > 1);
+  assertEquals("patch_toText: Chunks.", dmp.patch_toText(patches), chunks.join(""));
+
+  // Encodings many times longer than the text still give bounded chunks.
+  QList<Patch> wide;
+  patch = Patch();
+  patch.diffs.append(Diff(INSERT, QString(20000, QChar(0x4e2d))));
+  for (int x = 0; x < 5000; x++) {
+    patch.diffs.append(Diff(EQUAL, ""));
+  }
+  patch.length2 = 20000;
+  wide.append(patch);
+  chunks.clear();
+  dmp.patch_toText(wide, appendChunk, &chunks);
+  int longest = 0;
+  foreach (const QString &chunk, chunks) {
+    longest = qMax(longest, chunk.length());
+  }
+  assertTrue("patch_toText: Chunk size bounded.", longest < 2 * diff_match_patch::SINK_CHUNK);
+  assertEquals("patch_toText: Encoded chunks.", dmp.patch_toText(wide), chunks.join(""));
+
+  // Stream to a device.
+  QBuffer buffer;
+  buffer.open(QIODevice::WriteOnly);
+  assertTrue("patch_toText: Device.", dmp.patch_toText(patches, &buffer));
+  assertTrue("patch_toText: Device UTF-8.", buffer.data() == dmp.patch_toText(patches).toUtf8());
+
+  QBuffer closed;
+  assertFalse("patch_toText: Device not writable.", dmp.patch_toText(patches, &closed));
+}
+
+void diff_match_patch_test::testPatchReader() {
+  // One patch at a time from a string.
+  QString strp = "@@ -1,9 +1,9 @@\n-f\n+F\n oo+fooba\n\n@@ -7,9 +7,9 @@\n obar\n-,\n+.\n  tes\n@@ -0,0 +1 @@\n+%C3%A9\n";
+  PatchReader reader(strp);
+  QList<Patch> patches;
+  while (reader.hasNext()) {
+    patches.append(reader.next());
+  }
+  assertEquals("PatchReader: String.", dmp.patch_toText(dmp.patch_fromText(strp)), dmp.patch_toText(patches));
+  assertEquals("PatchReader: String count.", 3, patches.size());
+  assertFalse("PatchReader: String done.", reader.hasNext());
+  try {
+    reader.next();
+    assertFalse("PatchReader: Past the end.", true);
+  } catch (const char *ex) {
+    // Exception expected.
+  }
+
+  // From a device, as UTF-8.
+  QBuffer buffer;
+  buffer.setData(strp.toUtf8());
+  buffer.open(QIODevice::ReadOnly);
+  PatchReader deviceReader(&buffer);
+  patches.clear();
+  while (deviceReader.hasNext()) {
+    patches.append(deviceReader.next());
+  }
+  assertEquals("PatchReader: Device.", dmp.patch_toText(dmp.patch_fromText(strp)), dmp.patch_toText(patches));
+
+  // Empty input.
+  assertFalse("PatchReader: Empty.", PatchReader(QString("\n\n")).hasNext());
+
+  // Bad headers and modes.
+  QStringList bad;
+  bad << "Bad\nPatch\n" << "@@ -1,2 +1,2 @@ \n" << "@@ -1,,2 +1 @@\n" << "@@ -1 +1 @@\n-a\n*b\n";
+  foreach (const QString &text, bad) {
+    try {
+      PatchReader badReader(text);
+      while (badReader.hasNext()) {
+        badReader.next();
+      }
+      assertFalse("PatchReader: Invalid " + text, true);
+    } catch (QString ex) {
+      // Exception expected.
+    }
+  }
 }
 
 void diff_match_patch_test::testPatchAddContext() {
@@ -786,6 +1385,17 @@ void diff_match_patch_test::testPatchMake() {
   patches = dmp.patch_make(text1, text2);
   assertEquals("patch_make: Long string with repeats.", expectedPatch, dmp.patch_toText(patches));
 
+  // A small equality equal to the final one still belongs to the patch.
+  diffs = diffList(Diff(DELETE, "x"), Diff(EQUAL, "ab"), Diff(INSERT, "y"), Diff(EQUAL, "ab"));
+  patches = dmp.patch_make("xabab", diffs);
+  assertEquals("patch_make: Repeated equality.", "@@ -1,5 +1,5 @@\n-x\n ab\n+y\n ab\n", dmp.patch_toText(patches));
+
+  // Rolling context of later patches comes from the patched text.
+  text1 = "The quick brown fox jumps over the lazy dog, and the quick brown fox sleeps.";
+  text2 = "The slow brown fox jumps over the lazy cat, and the slow brown fox sleeps.";
+  patches = dmp.patch_make(text1, text2);
+  assertEquals("patch_make: Rolling context.", text2, dmp.patch_apply(patches, text1).first);
+
   // Test null inputs.
   try {
     dmp.patch_make(NULL, NULL);
@@ -814,6 +1424,20 @@ void diff_match_patch_test::testPatchSplitMax() {
   patches = dmp.patch_make("abcdefghij , h : 0 , t : 1 abcdefghij , h : 0 , t : 1 abcdefghij , h : 0 , t : 1", "abcdefghij , h : 1 , t : 1 abcdefghij , h : 1 , t : 1 abcdefghij , h : 0 , t : 1");
   dmp.patch_splitMax(patches);
   assertEquals("patch_splitMax: #4.", "@@ -2,32 +2,32 @@\n bcdefghij , h : \n-0\n+1\n  , t : 1 abcdef\n@@ -29,32 +29,32 @@\n bcdefghij , h : \n-0\n+1\n  , t : 1 abcdef\n", dmp.patch_toText(patches));
+
+  patches = dmp.patch_make("abc", "abd");
+  patches += dmp.patch_make("abcdefghijklmnopqrstuvwxyz01234567890", "XabXcdXefXghXijXklXmnXopXqrXstXuvXwxXyzX01X23X45X67X89X0");
+  patches += dmp.patch_make("xyz", "xwz");
+  dmp.patch_splitMax(patches);
+  assertEquals("patch_splitMax: Neighbours kept in order.", "@@ -1,3 +1,3 @@\n ab\n-c\n+d\n@@ -1,32 +1,46 @@\n+X\n ab\n+X\n cd\n+X\n ef\n+X\n gh\n+X\n ij\n+X\n kl\n+X\n mn\n+X\n op\n+X\n qr\n+X\n st\n+X\n uv\n+X\n wx\n+X\n yz\n+X\n 012345\n@@ -25,13 +39,18 @@\n zX01\n+X\n 23\n+X\n 45\n+X\n 67\n+X\n 89\n+X\n 0\n@@ -1,3 +1,3 @@\n x\n-y\n+w\n z\n", dmp.patch_toText(patches));
+
+  // No limit, no splitting.
+  dmp.Match_MaxBits = 0;
+  patches = dmp.patch_make("abcdefghijklmnopqrstuvwxyz01234567890", "XabXcdXefXghXijXklXmnXopXqrXstXuvXwxXyzX01X23X45X67X89X0");
+  oldToText = dmp.patch_toText(patches);
+  dmp.patch_splitMax(patches);
+  assertEquals("patch_splitMax: No limit.", oldToText, dmp.patch_toText(patches));
+  dmp.Match_MaxBits = 32;
 }
 
 void diff_match_patch_test::testPatchAddPadding() {
@@ -874,6 +1498,15 @@ void diff_match_patch_test::testPatchApply() {
   resultStr = results.first + "\t" + (boolArray[0] ? "true" : "false") + "\t" + (boolArray[1] ? "true" : "false");
   assertEquals("patch_apply: Big delete, large change 1.", "xabc12345678901234567890---------------++++++++++---------------12345678901234567890y\tfalse\ttrue", resultStr);
 
+  // Without a pattern limit the whole deletion is matched in one piece.
+  dmp.Match_MaxBits = 0;
+  patches = dmp.patch_make("x1234567890123456789012345678901234567890123456789012345678901234567890y", "xabcy");
+  results = dmp.patch_apply(patches, "x123456789012345678901234567890----++++++++++----12345678901234567890y");
+  boolArray = results.second;
+  resultStr = results.first + "\t" + QString::number(boolArray.size()) + "\t" + (boolArray[0] ? "true" : "false");
+  assertEquals("patch_apply: Big delete, no limit.", "xabcy\t1\ttrue", resultStr);
+  dmp.Match_MaxBits = 32;
+
   dmp.Patch_DeleteThreshold = 0.6f;
   patches = dmp.patch_make("x1234567890123456789012345678901234567890123456789012345678901234567890y", "xabcy");
   results = dmp.patch_apply(patches, "x12345678901234567890---------------++++++++++---------------12345678901234567890y");
@@ -921,6 +1554,138 @@ void diff_match_patch_test::testPatchApply() {
   assertEquals("patch_apply: Edge partial match.", "x123\ttrue", resultStr);
 }
 
+void diff_match_patch_test::testPatchCompile() {
+  // Compile once, apply to several texts.
+  QList<Patch> patches = dmp.patch_make("The quick brown fox jumps over the lazy dog.", "That quick brown fox jumped over a lazy dog.");
+  CompiledPatchSet compiled = dmp.patch_compile(patches);
+  assertEquals("patch_compile: Size.", 2, compiled.size());
+  QStringList texts;
+  texts << "The quick brown fox jumps over the lazy dog." << "The quick red rabbit jumps over the tired tiger." << "I am the very model of a modern major general." << "";
+  foreach (const QString &text, texts) {
+    QPair<QString, QVector<bool> > expected = dmp.patch_apply(patches, text);
+    QPair<QString, QVector<bool> > results = dmp.patch_apply(compiled, text);
+    assertEquals("patch_compile: Text for " + text, expected.first, results.first);
+    assertTrue("patch_compile: Results for " + text, expected.second == results.second);
+  }
+  assertEquals("patch_compile: Patches unchanged.", "@@ -1,11 +1,12 @@\n Th\n-e\n+at\n  quick b\n@@ -22,18 +22,17 @@\n jump\n-s\n+ed\n  over \n-the\n+a\n  laz\n", dmp.patch_toText(patches));
+
+  // Oversized deletion, searched for by both ends.
+  patches = dmp.patch_make("x1234567890123456789012345678901234567890123456789012345678901234567890y", "xabcy");
+  compiled = dmp.patch_compile(patches);
+  QPair<QString, QVector<bool> > results = dmp.patch_apply(compiled, "x12345678901234567890---------------++++++++++---------------12345678901234567890y");
+  assertEquals("patch_compile: Big delete, big change.", "xabc12345678901234567890---------------++++++++++---------------12345678901234567890y", results.first);
+  assertTrue("patch_compile: Big delete, big change results.", !results.second[0] && results.second[1]);
+
+  // Searches keep the pattern limit the set was compiled with.
+  dmp.Match_MaxBits = 0;
+  compiled = dmp.patch_compile(patches);
+  dmp.Match_MaxBits = 8;
+  results = dmp.patch_apply(compiled, "x123456789012345678901234567890----++++++++++----12345678901234567890y");
+  assertEquals("patch_compile: Compiled pattern limit.", "xabcy", results.first);
+  dmp.Match_MaxBits = 32;
+
+  // Empty set.
+  results = dmp.patch_apply(CompiledPatchSet(), "abc");
+  assertEquals("patch_compile: Empty set.", "abc", results.first);
+  assertEquals("patch_compile: Empty set results.", 0, results.second.size());
+}
+
+/**
+ * Runs a batch apply from inside a pool thread.
+ */
+class BatchFromPool : public QRunnable {
+ public:
+  BatchFromPool(const diff_match_patch &_dmp, const CompiledPatchSet &_patches,
+                const QStringList &_texts, QThreadPool *_pool,
+                QList<QPair<QString, QVector<bool> > > *_results) :
+    dmp(_dmp), patches(_patches), texts(_texts), pool(_pool),
+    results(_results) {
+  }
+
+  void run() {
+    *results = dmp.patch_apply(patches, texts, pool);
+  }
+
+ private:
+  const diff_match_patch &dmp;
+  const CompiledPatchSet &patches;
+  const QStringList texts;
+  QThreadPool *pool;
+  QList<QPair<QString, QVector<bool> > > *results;
+};
+
+void diff_match_patch_test::testPatchApplyBatch() {
+  // Same results, in the same order, as applying one text at a time.
+  QList<Patch> patches = dmp.patch_make("The quick brown fox jumps over the lazy dog.", "That quick brown fox jumped over a lazy dog.");
+  CompiledPatchSet compiled = dmp.patch_compile(patches);
+  QStringList texts;
+  for (int x = 0; x < 50; x++) {
+    texts << QString("The quick brown fox %1 jumps over the lazy dog %2.").arg(x).arg(x % 7);
+  }
+  texts << "I am the very model of a modern major general." << "";
+  QThreadPool pool;
+  pool.setMaxThreadCount(4);
+  QList<QPair<QString, QVector<bool> > > results = dmp.patch_apply(compiled, texts, &pool);
+  assertEquals("patch_apply: Batch size.", texts.size(), results.size());
+  for (int x = 0; x < texts.size(); x++) {
+    QPair<QString, QVector<bool> > expected = dmp.patch_apply(compiled, texts[x]);
+    assertEquals("patch_apply: Batch text " + QString::number(x), expected.first, results[x].first);
+    assertTrue("patch_apply: Batch results " + QString::number(x), expected.second == results[x].second);
+  }
+
+  // Global pool, empty batch.
+  results = dmp.patch_apply(compiled, QStringList());
+  assertEquals("patch_apply: Empty batch.", 0, results.size());
+
+  // From the only thread of the same pool.
+  QThreadPool single;
+  single.setMaxThreadCount(1);
+  QList<QPair<QString, QVector<bool> > > nested;
+  single.start(new BatchFromPool(dmp, compiled, texts, &single, &nested));
+  single.waitForDone();
+  assertEquals("patch_apply: Batch from a pool thread.", texts.size(), nested.size());
+  assertEquals("patch_apply: Batch from a pool thread text.", dmp.patch_apply(compiled, texts[0]).first, nested[0].first);
+
+  // A failure on a pool thread reaches the caller.
+  QStringList withNull = texts;
+  withNull.insert(30, QString());
+  try {
+    dmp.patch_apply(compiled, withNull, &pool);
+    assertFalse("patch_apply: Batch failure.", true);
+  } catch (const char *ex) {
+    // Exception expected.
+  }
+}
+
+void diff_match_patch_test::testTextBuffer() {
+  // Edits in place, read back either side of the gap.
+  TextBuffer buffer("The quick brown fox.");
+  assertEquals("TextBuffer: Length.", 20, buffer.length());
+  buffer.replace(4, 5, "slow");
+  assertEquals("TextBuffer: Replace.", "The slow brown fox.", buffer.mid(0, -1));
+  buffer.replace(15, 3, "dog and a cat");
+  assertEquals("TextBuffer: Grow.", "The slow brown dog and a cat.", buffer.mid(0, -1));
+  buffer.replace(0, 4, "");
+  assertEquals("TextBuffer: Delete before the gap.", "slow brown dog and a cat.", buffer.mid(0, -1));
+  assertEquals("TextBuffer: Mid across the gap.", "brown dog", buffer.mid(5, 9));
+  assertEquals("TextBuffer: Mid past the end.", "cat.", buffer.mid(21, 10));
+  assertTrue("TextBuffer: Mid at the end.", buffer.mid(25, 1).isNull());
+  assertEquals("TextBuffer: Prefix.", "slow brown", QString(buffer.prefix(10), 10));
+  buffer.replace(25, 0, "!");
+  assertEquals("TextBuffer: Append.", "slow brown dog and a cat.!", buffer.mid(0, -1));
+
+  // Many patches over a long text.
+  QString text1, text2;
+  for (int x = 0; x < 200; x++) {
+    text1 += QString("Line %1 of the original.\n").arg(x);
+    text2 += QString(x % 3 == 0 ? "Line %1 of the changed one.\n" : "Line %1 of the original.\n").arg(x);
+  }
+  QList<Patch> patches = dmp.patch_make(text1, text2);
+  QPair<QString, QVector<bool> > results = dmp.patch_apply(patches, text1);
+  assertEquals("patch_apply: Many patches.", text2, results.first);
+  assertTrue("patch_apply: Many patches applied.", !results.second.contains(false));
+}
+
 
 void diff_match_patch_test::assertEquals(const QString &strCase, int n1, int n2) {
   if (n1 != n2) {
@@ -32,31 +32,42 @@ class diff_match_patch_test {
   void testDiffLinesToChars();
   void testDiffCharsToLines();
   void testDiffCleanupMerge();
+  void testDiffBlankLine();
   void testDiffCleanupSemanticLossless();
   void testDiffCleanupSemantic();
   void testDiffCleanupEfficiency();
   void testDiffPrettyHtml();
   void testDiffText();
   void testDiffDelta();
+  void testDiffCompose();
   void testDiffXIndex();
   void testDiffLevenshtein();
+  void testDiffDistance();
   void testDiffBisect();
   void testDiffMain();
+  void testSimilarityIndex();
 
   //  MATCH TEST FUNCTIONS
   void testMatchAlphabet();
   void testMatchBitap();
   void testMatchMain();
+  void testPreparedText();
+  void testTextSearch();
+  void testMatchMany();
 
   //  PATCH TEST FUNCTIONS
   void testPatchObj();
   void testPatchFromText();
   void testPatchToText();
+  void testPatchReader();
   void testPatchAddContext();
   void testPatchMake();
   void testPatchSplitMax();
   void testPatchAddPadding();
   void testPatchApply();
+  void testPatchCompile();
+  void testPatchApplyBatch();
+  void testTextBuffer();
 
  private:
   diff_match_patch dmp;
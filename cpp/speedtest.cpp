@@ -0,0 +1,137 @@
+/*
+ * Diff Match and Patch -- Speed Test
+ * Copyright 2018 The diff-match-patch Authors.
+ * https://github.com/google/diff-match-patch
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Code known to compile and run with Qt 4.3 through Qt 4.7.
+#include <QtCore>
+#include "diff_match_patch.h"
+
+// Repetitions of each of the faster benchmarks.
+static const int ITERATIONS = 1000;
+
+static QString readFile(const QString &filename) {
+  // Read a file from disk and return the text contents.
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly)) {
+    qDebug("Cannot read %s", qPrintable(filename));
+    return QString("");
+  }
+  return QString::fromUtf8(file.readAll());
+}
+
+static void speedtestDiff(const diff_match_patch &dmp, const QString &text1,
+                          const QString &text2) {
+  // Execute one reverse diff as a warmup.
+  dmp.diff_main(text2, text1, false);
+
+  QTime t;
+  t.start();
+  dmp.diff_main(text1, text2, false);
+  qDebug("diff_main: %d ms", t.elapsed());
+}
+
+static void speedtestDelta(const diff_match_patch &dmp, const QString &text1,
+                           const QString &text2) {
+  const QList<Diff> diffs = dmp.diff_main(text1, text2, false);
+  const QString delta = dmp.diff_toDelta(diffs);
+  const QByteArray binary = dmp.diff_toBinaryDelta(diffs);
+  qDebug("Delta size: text %d bytes, binary %d bytes",
+         delta.toUtf8().size(), binary.size());
+
+  QTime t;
+  t.start();
+  for (int i = 0; i < ITERATIONS; i++) {
+    dmp.diff_toDelta(diffs);
+  }
+  qDebug("diff_toDelta x%d: %d ms", ITERATIONS, t.elapsed());
+
+  t.start();
+  for (int i = 0; i < ITERATIONS; i++) {
+    dmp.diff_fromDelta(text1, delta);
+  }
+  qDebug("diff_fromDelta x%d: %d ms", ITERATIONS, t.elapsed());
+
+  t.start();
+  for (int i = 0; i < ITERATIONS; i++) {
+    dmp.diff_toBinaryDelta(diffs);
+  }
+  qDebug("diff_toBinaryDelta x%d: %d ms", ITERATIONS, t.elapsed());
+
+  t.start();
+  for (int i = 0; i < ITERATIONS; i++) {
+    dmp.diff_fromBinaryDelta(text1, binary);
+  }
+  qDebug("diff_fromBinaryDelta x%d: %d ms", ITERATIONS, t.elapsed());
+}
+
+static void speedtestSearchCase(const char *name, const QString &text,
+                                const QString &pattern) {
+  int sum = 0;
+  QTime t;
+  t.start();
+  for (int i = 0; i < ITERATIONS; i++) {
+    sum += TextSearch::indexOf(text, pattern);
+  }
+  const int kernel = t.elapsed();
+  t.start();
+  for (int i = 0; i < ITERATIONS; i++) {
+    sum -= text.indexOf(pattern);
+  }
+  const int qt = t.elapsed();
+  qDebug("indexOf %s x%d: TextSearch %d ms, QString %d ms", name, ITERATIONS,
+         kernel, qt);
+
+  t.start();
+  for (int i = 0; i < ITERATIONS; i++) {
+    sum += TextSearch::lastIndexOf(text, pattern);
+  }
+  const int lastKernel = t.elapsed();
+  t.start();
+  for (int i = 0; i < ITERATIONS; i++) {
+    sum -= text.lastIndexOf(pattern);
+  }
+  const int lastQt = t.elapsed();
+  qDebug("lastIndexOf %s x%d: TextSearch %d ms, QString %d ms", name,
+         ITERATIONS, lastKernel, lastQt);
+  if (sum != 0) {
+    qDebug("Search results differ!");
+  }
+}
+
+static void speedtestSearch(const QString &text) {
+  // Text from the middle ending in \x01, which the text lacks.  These
+  // patterns are absent, so each search scans the whole text.
+  const int middle = text.length() / 2;
+  speedtestSearchCase("2 chars", text, text.mid(middle, 1) + "\x01");
+  speedtestSearchCase("16 chars", text, text.mid(middle, 15) + "\x01");
+  speedtestSearchCase("200 chars", text, text.mid(middle, 199) + "\x01");
+  speedtestSearchCase("present", text, text.right(24));
+}
+
+int main(int argc, char **argv) {
+  // Usage: speedtest [speedtest1.txt speedtest2.txt]
+  const QString text1 = readFile(argc > 2 ? argv[1] : "speedtest1.txt");
+  const QString text2 = readFile(argc > 2 ? argv[2] : "speedtest2.txt");
+
+  diff_match_patch dmp;
+  dmp.Diff_Timeout = 0;
+
+  speedtestDiff(dmp, text1, text2);
+  speedtestDelta(dmp, text1, text2);
+  speedtestSearch(text1);
+  return 0;
+}
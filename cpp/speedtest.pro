@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += qt release console
+
+mac {
+  CONFIG -= app_bundle
+}
+
+HEADERS = diff_match_patch.h
+
+SOURCES = diff_match_patch.cpp speedtest.cpp